@@ -7,6 +7,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/thread.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -48,6 +49,9 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* Most sectors a single READ/WRITE SECTOR command can transfer. */
+#define MAX_SECTOR_CNT 256
+
 /* An ATA device. */
 struct disk {
 	char name[8];               /* Name, e.g. "hd0:1". */
@@ -84,7 +88,7 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct disk *);
 static void identify_ata_device (struct disk *);
 
-static void select_sector (struct disk *, disk_sector_t);
+static void select_sector (struct disk *, disk_sector_t, size_t cnt);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -216,13 +220,14 @@ disk_read (struct disk *d, disk_sector_t sec_no, void *buffer) {
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, 1);
 	issue_pio_command (c, CMD_READ_SECTOR_RETRY);
 	sema_down (&c->completion_wait);
 	if (!wait_while_busy (d))
 		PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
 	input_sector (c, buffer);
 	d->read_cnt++;
+	thread_current ()->disk_cnt++;
 	lock_release (&c->lock);
 }
 
@@ -240,13 +245,91 @@ disk_write (struct disk *d, disk_sector_t sec_no, const void *buffer) {
 
 	c = d->channel;
 	lock_acquire (&c->lock);
-	select_sector (d, sec_no);
+	select_sector (d, sec_no, 1);
 	issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
 	if (!wait_while_busy (d))
 		PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
 	output_sector (c, buffer);
 	sema_down (&c->completion_wait);
 	d->write_cnt++;
+	thread_current ()->disk_cnt++;
+	lock_release (&c->lock);
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D, sector
+   SEC_NO + I going into BUFFERS[I], which must have room for
+   DISK_SECTOR_SIZE bytes.
+   The sectors are transferred with as few commands as possible,
+   which saves the device selection and setup that disk_read()
+   pays for every sector. */
+void
+disk_read_multiple (struct disk *d, disk_sector_t sec_no, void **buffers,
+		size_t cnt) {
+	struct channel *c;
+
+	ASSERT (d != NULL);
+	ASSERT (buffers != NULL);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	while (cnt > 0) {
+		size_t chunk = cnt < MAX_SECTOR_CNT ? cnt : MAX_SECTOR_CNT;
+		size_t i;
+
+		select_sector (d, sec_no, chunk);
+		issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+		for (i = 0; i < chunk; i++) {
+			/* The device interrupts once per sector. */
+			sema_down (&c->completion_wait);
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name,
+						sec_no + (disk_sector_t) i);
+			input_sector (c, buffers[i]);
+		}
+		d->read_cnt += chunk;
+		thread_current ()->disk_cnt += chunk;
+		sec_no += chunk;
+		buffers += chunk;
+		cnt -= chunk;
+	}
+	lock_release (&c->lock);
+}
+
+/* Writes the CNT sectors starting at SEC_NO to disk D, sector
+   SEC_NO + I coming from BUFFERS[I], which must contain
+   DISK_SECTOR_SIZE bytes.  Returns after the disk has
+   acknowledged receiving all of the data.  See
+   disk_read_multiple(). */
+void
+disk_write_multiple (struct disk *d, disk_sector_t sec_no,
+		const void **buffers, size_t cnt) {
+	struct channel *c;
+
+	ASSERT (d != NULL);
+	ASSERT (buffers != NULL);
+
+	c = d->channel;
+	lock_acquire (&c->lock);
+	while (cnt > 0) {
+		size_t chunk = cnt < MAX_SECTOR_CNT ? cnt : MAX_SECTOR_CNT;
+		size_t i;
+
+		select_sector (d, sec_no, chunk);
+		issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+		for (i = 0; i < chunk; i++) {
+			if (!wait_while_busy (d))
+				PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name,
+						sec_no + (disk_sector_t) i);
+			output_sector (c, buffers[i]);
+			/* The device interrupts once each sector is written. */
+			sema_down (&c->completion_wait);
+		}
+		d->write_cnt += chunk;
+		thread_current ()->disk_cnt += chunk;
+		sec_no += chunk;
+		buffers += chunk;
+		cnt -= chunk;
+	}
 	lock_release (&c->lock);
 }
 
@@ -402,17 +485,19 @@ print_ata_string (char *string, size_t size) {
 }
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and the count CNT of sectors to transfer to the
+   disk's sector selection registers.  (We use LBA mode.) */
 static void
-select_sector (struct disk *d, disk_sector_t sec_no) {
+select_sector (struct disk *d, disk_sector_t sec_no, size_t cnt) {
 	struct channel *c = d->channel;
 
-	ASSERT (sec_no < d->capacity);
-	ASSERT (sec_no < (1UL << 28));
+	ASSERT (cnt >= 1 && cnt <= MAX_SECTOR_CNT);
+	ASSERT (sec_no + cnt - 1 < d->capacity);
+	ASSERT (sec_no + cnt - 1 < (1UL << 28));
 
 	select_device_wait (d);
-	outb (reg_nsect (c), 1);
+	/* A count of 0 means 256 sectors. */
+	outb (reg_nsect (c), cnt % MAX_SECTOR_CNT);
 	outb (reg_lbal (c), sec_no);
 	outb (reg_lbam (c), sec_no >> 8);
 	outb (reg_lbah (c), (sec_no >> 16));
@@ -8,6 +8,7 @@ struct file {
 	struct inode *inode;        /* File's inode. */
 	off_t pos;                  /* Current position. */
 	bool deny_write;            /* Has file_deny_write() been called? */
+	bool direct;                /* Opened for direct I/O? */
 };
 
 /* Opens a file for the given INODE, of which it takes ownership,
@@ -20,6 +21,7 @@ file_open (struct inode *inode) {
 		file->inode = inode;
 		file->pos = 0;
 		file->deny_write = false;
+		file->direct = false;
 		return file;
 	} else {
 		inode_close (inode);
@@ -42,6 +44,7 @@ file_duplicate (struct file *file) {
 	struct file *nfile = file_open (inode_reopen (file->inode));
 	if (nfile) {
 		nfile->pos = file->pos;
+		nfile->direct = file->direct;
 		if (file->deny_write)
 			file_deny_write (nfile);
 	}
@@ -113,6 +116,35 @@ file_write_at (struct file *file, const void *buffer, off_t size,
 	return inode_write_at (file->inode, buffer, size, file_ofs);
 }
 
+/* Reads, or writes if WRITE, CNT whole sectors at FILE's current
+ * position, which must be a multiple of DISK_SECTOR_SIZE, straight
+ * between the disk and BUFFERS, sector I going from or to
+ * BUFFERS[I], bypassing the page cache.  Nothing is moved unless all
+ * CNT sectors lie within the file.  Returns the number of bytes
+ * actually moved.  Advances FILE's position by that amount. */
+off_t
+file_direct_io (struct file *file, void **buffers, size_t cnt, bool write) {
+	off_t bytes = inode_direct_io (file->inode, buffers, cnt, file->pos,
+			write);
+	file->pos += bytes;
+	return bytes;
+}
+
+/* Marks FILE for direct I/O if DIRECT, so that large aligned reads
+ * and writes through system calls bypass the page cache. */
+void
+file_set_direct (struct file *file, bool direct) {
+	ASSERT (file != NULL);
+	file->direct = direct;
+}
+
+/* Returns true if FILE was marked for direct I/O. */
+bool
+file_is_direct (struct file *file) {
+	ASSERT (file != NULL);
+	return file->direct;
+}
+
 /* Prevents write operations on FILE's underlying inode
  * until file_allow_write() is called or FILE is closed. */
 void
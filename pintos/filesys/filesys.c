@@ -7,6 +7,9 @@
 #include "filesys/inode.h"
 #include "filesys/directory.h"
 #include "devices/disk.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 /* The disk that contains the file system. */
 struct disk *filesys_disk;
@@ -45,6 +48,9 @@ filesys_init (bool format) {
  * to disk. */
 void
 filesys_done (void) {
+#ifdef VM
+	page_cache_sync ();
+#endif
 	/* Original FS */
 #ifdef EFILESYS
 	fat_close ();
@@ -6,6 +6,9 @@
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#ifdef VM
+#include "vm/vm.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
@@ -137,6 +140,13 @@ inode_reopen (struct inode *inode) {
 	return inode;
 }
 
+/* Returns the disk sector that contains byte offset POS within
+ * INODE, or -1 if INODE has no data at POS. */
+disk_sector_t
+inode_sector_at (const struct inode *inode, off_t pos) {
+	return byte_to_sector (inode, pos);
+}
+
 /* Returns INODE's inode number. */
 disk_sector_t
 inode_get_inumber (const struct inode *inode) {
@@ -157,6 +167,11 @@ inode_close (struct inode *inode) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
 
+#ifdef VM
+		/* Write back cached data, unless the blocks are freed. */
+		page_cache_close (inode, inode->removed);
+#endif
+
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
@@ -181,6 +196,9 @@ inode_remove (struct inode *inode) {
  * than SIZE if an error occurs or end of file is reached. */
 off_t
 inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+#ifdef VM
+	return page_cache_read (inode, buffer_, size, offset);
+#else
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
 	uint8_t *bounce = NULL;
@@ -223,6 +241,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 	free (bounce);
 
 	return bytes_read;
+#endif
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
@@ -233,6 +252,11 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
+#ifdef VM
+	if (inode->deny_write_cnt)
+		return 0;
+	return page_cache_write (inode, buffer_, size, offset);
+#else
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
 	uint8_t *bounce = NULL;
@@ -285,6 +309,38 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 	free (bounce);
 
 	return bytes_written;
+#endif
+}
+
+/* Reads, or writes if WRITE, the CNT sectors of INODE's data from
+ * OFFSET, a multiple of DISK_SECTOR_SIZE, straight between the disk
+ * and BUFFERS, sector I going from or to BUFFERS[I], without bounce
+ * buffers or the page cache.  Returns the number of bytes moved:
+ * all of them, or none if the sectors do not all lie within the
+ * file or if writes are denied. */
+off_t
+inode_direct_io (struct inode *inode, void **buffers, size_t cnt,
+		off_t offset, bool write) {
+	ASSERT (offset % DISK_SECTOR_SIZE == 0);
+
+	if (offset < 0 || offset > inode_length (inode)
+			|| cnt > (size_t) (inode_length (inode) - offset) / DISK_SECTOR_SIZE
+			|| (write && inode->deny_write_cnt))
+		return 0;
+#ifdef VM
+	page_cache_direct_io (inode, offset, buffers, cnt, write);
+#else
+	for (size_t i = 0; i < cnt; i++) {
+		disk_sector_t sector_idx = byte_to_sector (inode,
+				offset + i * DISK_SECTOR_SIZE);
+
+		if (write)
+			disk_write (filesys_disk, sector_idx, buffers[i]);
+		else
+			disk_read (filesys_disk, sector_idx, buffers[i]);
+	}
+#endif
+	return cnt * DISK_SECTOR_SIZE;
 }
 
 /* Disables writes to INODE.
@@ -1,9 +1,23 @@
 /* page_cache.c: Implementation of Page Cache (Buffer Cache). */
 
 #include "vm/vm.h"
+#ifdef VM
+#include <round.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "filesys/inode.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
+static void page_cache_kworkerd (void *aux);
 
 /* DO NOT MODIFY this struct */
 static const struct page_operations page_cache_op = {
@@ -13,38 +27,847 @@ static const struct page_operations page_cache_op = {
 	.type = VM_PAGE_CACHE,
 };
 
+/* Every page of file data read or written goes through the cache.
+ * Cache pages are kernel pages in frames of the frame table: the
+ * clock evicts them like any other page, writing them back if dirty,
+ * and file mappings share their frames.  Evicted pages stay indexed,
+ * without a frame, until kworkerd forgets them. */
+static struct hash cache_index;     /* Cached pages by (sector, ofs). */
+static struct list cache_pages;     /* All cached pages. */
+static struct lock cache_lock;      /* Protects the above. */
+static bool cache_ready;            /* Has page_cache_init() run? */
+
+/* Disk transfers run without CACHE_LOCK.  A page being read in is
+ * marked loading, and lookups of it wait on LOAD_DONE.  Write-back is
+ * serialized by FLUSH_LOCK, which is taken before CACHE_LOCK, and
+ * pages leave the cache only with FLUSH_LOCK held, so that a flush
+ * can walk CACHE_PAGES across its writes. */
+static struct condition load_done;
+static struct lock flush_lock;
+
+/* Sectors in a page. */
+#define SECTORS_PER_PAGE (PGSIZE / DISK_SECTOR_SIZE)
+
+/* Readahead window for a miss on the first page of a file. */
+#define RA_INIT 4
+
+/* Sector buffers of a readahead, protected by RA_LOCK, and of a
+ * run of pages written back together, protected by FLUSH_LOCK. */
+static struct lock ra_lock;
+static void *ra_buffers[PAGE_CACHE_RA_MAX * SECTORS_PER_PAGE];
+static void *io_buffers[PAGE_CACHE_RA_MAX * SECTORS_PER_PAGE];
+
+/* Dirty pages written back together, in disk order, by
+ * flush_pages(), with the disk sector each starts at.  Protected by
+ * FLUSH_LOCK. */
+#define FLUSH_BATCH 64
+struct flush_entry {
+	disk_sector_t sector;
+	struct page *page;
+};
+static struct flush_entry flush_batch[FLUSH_BATCH];
+
+/* kworkerd lets dirty pages gather for FLUSH_DELAY ticks before
+ * writing them back, checking every FLUSH_SLICE ticks whether memory
+ * has become short, or prefetches have arrived, in the meantime. */
+#define FLUSH_DELAY TIMER_FREQ
+#define FLUSH_SLICE (TIMER_FREQ / 10)
+
+/* kworkerd's state, protected by disabling interrupts. */
 tid_t page_cache_workerd;
+static struct semaphore kworkerd_sema;
+static bool kworkerd_idle;          /* Blocked on KWORKERD_SEMA. */
+static bool kworkerd_dirty;         /* There are pages to write back. */
+static int64_t kworkerd_dirty_ticks; /* When KWORKERD_DIRTY was set. */
+static bool kworkerd_urgent;        /* Flush without waiting. */
+static struct list prefetch_queue;  /* Ranges to read in. */
+
+/* A range of a file for kworkerd to read into the cache, queued by
+ * page_cache_prefetch(). */
+struct prefetch {
+	struct inode *inode;         /* Reopened for the prefetch. */
+	off_t ofs;                   /* Offset of the first page. */
+	size_t page_cnt;             /* Number of pages. */
+	struct list_elem elem;       /* Element in PREFETCH_QUEUE. */
+};
+
+/* Page cache statistics. */
+static long long hit_cnt;           /* # of lookups of resident pages. */
+static long long miss_cnt;          /* # of lookups that read a page. */
+static long long ra_cnt;            /* # of pages read ahead. */
+static long long writeback_cnt;     /* # of pages written back. */
+
+/* Returns a hash value for cache page E. */
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	const struct page *p = hash_entry (e, struct page, page_cache.hash_elem);
+	uint64_t key[2] = {p->page_cache.sector, p->page_cache.ofs};
+
+	return hash_bytes (key, sizeof key);
+}
+
+/* Returns true if cache page A precedes cache page B. */
+static bool
+cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a =
+		&hash_entry (a_, struct page, page_cache.hash_elem)->page_cache;
+	const struct page_cache *b =
+		&hash_entry (b_, struct page, page_cache.hash_elem)->page_cache;
+
+	if (a->sector != b->sector)
+		return a->sector < b->sector;
+	return a->ofs < b->ofs;
+}
 
-/* The initializer of file vm */
+/* Initializes the page cache and starts kworkerd. */
 void
-pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+page_cache_init (void) {
+	hash_init (&cache_index, cache_hash, cache_less, NULL);
+	list_init (&cache_pages);
+	lock_init (&cache_lock);
+	cond_init (&load_done);
+	lock_init (&flush_lock);
+	lock_init (&ra_lock);
+	sema_init (&kworkerd_sema, 0);
+	list_init (&prefetch_queue);
+	page_cache_workerd = thread_create ("kworkerd", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
+	if (page_cache_workerd == TID_ERROR)
+		PANIC ("page_cache_init: cannot start kworkerd");
+	cache_ready = true;
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %lld hits, %lld misses, %lld pages read ahead, "
+			"%lld pages written back\n",
+			hit_cnt, miss_cnt, ra_cnt, writeback_cnt);
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
+	return true;
+}
+
+/* Returns the cached page for OFS in the file whose inode is in
+ * SECTOR, or a null pointer.  Must be called with CACHE_LOCK held. */
+static struct page *
+cache_lookup (disk_sector_t sector, off_t ofs) {
+	struct page key;
+	struct hash_elem *e;
+
+	key.page_cache.sector = sector;
+	key.page_cache.ofs = ofs;
+	e = hash_find (&cache_index, &key.page_cache.hash_elem);
+	return e != NULL ? hash_entry (e, struct page, page_cache.hash_elem)
+		: NULL;
+}
+
+/* Adds a page for OFS in INODE to the cache, without a frame, and
+ * returns it.  Returns a null pointer if out of memory.  Must be
+ * called with CACHE_LOCK held. */
+static struct page *
+cache_create (struct inode *inode, off_t ofs) {
+	struct page *page = malloc (sizeof *page);
+
+	if (page == NULL)
+		return NULL;
+	page->va = NULL;
+	page->frame = NULL;
+	page->owner = NULL;
+	page->writable = false;
+	page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+	page->page_cache.sector = inode_get_inumber (inode);
+	page->page_cache.inode = inode;
+	page->page_cache.ofs = ofs;
+	page->page_cache.ra_window = 1;
+	page->page_cache.advice = MADV_NORMAL;
+	page->page_cache.loading = false;
+	hash_insert (&cache_index, &page->page_cache.hash_elem);
+	list_push_back (&cache_pages, &page->page_cache.list_elem);
+	return page;
+}
+
+/* Removes PAGE from the cache and frees it.  Must be called with
+ * FLUSH_LOCK and CACHE_LOCK held. */
+static void
+cache_remove (struct page *page) {
+	hash_delete (&cache_index, &page->page_cache.hash_elem);
+	list_remove (&page->page_cache.list_elem);
+	vm_dealloc_page (page);
+}
+
+/* Returns the number of sectors of INODE's data in the page at
+ * OFS. */
+static size_t
+page_sector_cnt (struct inode *inode, off_t ofs) {
+	off_t left = inode_length (inode) - ofs;
 
+	if (left <= 0)
+		return 0;
+	if (left >= PGSIZE)
+		return SECTORS_PER_PAGE;
+	return DIV_ROUND_UP (left, DISK_SECTOR_SIZE);
+}
+
+/* Reads, or writes if WRITE, the CNT sectors of INODE's data that
+ * start at byte OFS, sector I going from or to BUFFERS[I].  Runs of
+ * sectors that are consecutive on disk move in one command. */
+static void
+transfer_sectors (struct inode *inode, off_t ofs, void **buffers,
+		size_t cnt, bool write) {
+	size_t i = 0;
+
+	while (i < cnt) {
+		disk_sector_t start = inode_sector_at (inode,
+				ofs + i * DISK_SECTOR_SIZE);
+		size_t run = 1;
+
+		while (i + run < cnt
+				&& inode_sector_at (inode, ofs + (i + run) * DISK_SECTOR_SIZE)
+				== start + run)
+			run++;
+		if (write)
+			disk_write_multiple (filesys_disk, start,
+					(const void **) buffers + i, run);
+		else
+			disk_read_multiple (filesys_disk, start, buffers + i, run);
+		i += run;
+	}
+}
+
+/* Writes the contents of cache page PAGE, which must be resident
+ * and belong to an open file, back to the file. */
+static void
+write_page (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+	void *buffers[SECTORS_PER_PAGE];
+	size_t cnt, i;
+
+	ASSERT (pc->inode != NULL);
+
+	cnt = page_sector_cnt (pc->inode, pc->ofs);
+	for (i = 0; i < cnt; i++)
+		buffers[i] = (uint8_t *) page->frame->kva + i * DISK_SECTOR_SIZE;
+	transfer_sectors (pc->inode, pc->ofs, buffers, cnt, true);
+	writeback_cnt++;
+}
+
+/* Writes back the CNT cache pages in RUN, which hold consecutive
+ * pages of INODE's data from OFS and were cleaned and pinned by
+ * vm_clean_page(), in as few disk commands as the file's layout
+ * allows, and unpins them.  Must be called with FLUSH_LOCK held. */
+static void
+write_run (struct inode *inode, off_t ofs, struct page **run, size_t cnt) {
+	size_t sector_cnt = 0, i, j;
+
+	for (i = 0; i < cnt; i++) {
+		size_t n = page_sector_cnt (inode, run[i]->page_cache.ofs);
+
+		for (j = 0; j < n; j++)
+			io_buffers[sector_cnt++] =
+				(uint8_t *) run[i]->frame->kva + j * DISK_SECTOR_SIZE;
+	}
+	transfer_sectors (inode, ofs, io_buffers, sector_cnt, true);
+	for (i = 0; i < cnt; i++)
+		vm_unpin_page (run[i]);
+	writeback_cnt += cnt;
+}
+
+/* Returns how many pages to read on a miss on PC: just the one
+ * after a random access, or, when the page before it is resident, a
+ * window twice the size of the one that read that page, up to
+ * PAGE_CACHE_RA_MAX.  A page read for a mapping advised MADV_RANDOM
+ * always reads a single page and one advised MADV_SEQUENTIAL the
+ * largest window.  Must be called with CACHE_LOCK held. */
+static size_t
+ra_window (struct page_cache *pc) {
+	struct page *prev;
+	size_t window;
+
+	if (pc->advice == MADV_RANDOM)
+		return 1;
+	if (pc->advice == MADV_SEQUENTIAL)
+		return PAGE_CACHE_RA_MAX;
+	if (pc->ofs == 0)
+		return RA_INIT;
+	prev = cache_lookup (pc->sector, pc->ofs - PGSIZE);
+	if (prev == NULL || prev->frame == NULL)
+		return 1;
+	window = prev->page_cache.ra_window * 2;
+	return window < PAGE_CACHE_RA_MAX ? window : PAGE_CACHE_RA_MAX;
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
+/* Reads PAGE, which page_cache_get() marked loading, into KVA
+ * together with the pages that follow it, up to the readahead
+ * window, that are not cached yet, in as few disk commands as the
+ * file's layout allows.  The pages read ahead are marked loading too
+ * while the read runs without CACHE_LOCK.  Pages past the end of the
+ * file read as zeros.  The pages read ahead are left unpinned and
+ * unreferenced, so they are the first to go if nobody uses them. */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct page_cache *pc = &page->page_cache;
+	struct inode *inode = pc->inode;
+	struct page *pages[PAGE_CACHE_RA_MAX];
+	size_t window, cnt = 1, ready, sector_cnt = 0, i, j;
+
+	ASSERT (inode != NULL);
+	ASSERT (pc->loading);
+
+	lock_acquire (&cache_lock);
+	window = ra_window (pc);
+	pages[0] = page;
+	while (cnt < window) {
+		off_t ofs = pc->ofs + cnt * PGSIZE;
+		struct page *next;
+
+		if (ofs >= inode_length (inode))
+			break;
+		next = cache_lookup (pc->sector, ofs);
+		if (next != NULL && (next->frame != NULL || next->page_cache.loading))
+			break;
+		if (next == NULL && (next = cache_create (inode, ofs)) == NULL)
+			break;
+		next->page_cache.inode = inode;
+		next->page_cache.loading = true;
+		pages[cnt++] = next;
+	}
+	lock_release (&cache_lock);
+
+	/* The read stops at the first page that gets no frame. */
+	for (ready = 1; ready < cnt; ready++)
+		if (!vm_reserve_frame (pages[ready]))
+			break;
+
+	lock_acquire (&ra_lock);
+	for (i = 0; i < ready; i++) {
+		uint8_t *dst = i == 0 ? kva : pages[i]->frame->kva;
+		size_t n = page_sector_cnt (inode, pages[i]->page_cache.ofs);
+
+		for (j = 0; j < n; j++)
+			ra_buffers[sector_cnt++] = dst + j * DISK_SECTOR_SIZE;
+		memset (dst + n * DISK_SECTOR_SIZE, 0, PGSIZE - n * DISK_SECTOR_SIZE);
+		pages[i]->page_cache.ra_window = window;
+	}
+	transfer_sectors (inode, pc->ofs, ra_buffers, sector_cnt, false);
+	lock_release (&ra_lock);
+
+	lock_acquire (&cache_lock);
+	for (i = 1; i < cnt; i++)
+		pages[i]->page_cache.loading = false;
+	cond_broadcast (&load_done, &cache_lock);
+	lock_release (&cache_lock);
+
+	for (i = 1; i < ready; i++)
+		vm_unpin_page (pages[i]);
+	ra_cnt += ready - 1;
+	return true;
 }
 
 /* Utilze the Swap out mechanism to implement writeback */
+/* Writes PAGE back if it is dirty.  Reclaim writing back a page
+ * itself means kworkerd is falling behind, so it is woken to clean
+ * the others before the clock gets to them. */
 static bool
 page_cache_writeback (struct page *page) {
+	if (page->frame->dirty) {
+		write_page (page);
+		page_cache_wake_kworkerd (true);
+	}
+	return true;
 }
 
 /* Destory the page_cache. */
 static void
 page_cache_destroy (struct page *page) {
+	vm_free_frame (page);
+}
+
+/* Returns the cache page holding INODE's data at OFS, which must be
+ * a multiple of PGSIZE, reading it in first if it is not resident,
+ * with a readahead window suited to ADVICE, the MADV_* advice for the
+ * access.  The read runs without CACHE_LOCK, so that lookups of other
+ * pages go on meanwhile; lookups of the page itself wait for it.  The
+ * page is returned pinned, and must be released with
+ * page_cache_put().  Returns a null pointer if out of memory. */
+struct page *
+page_cache_get (struct inode *inode, off_t ofs, int advice) {
+	struct page *page;
+	bool pinned;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	lock_acquire (&cache_lock);
+	for (;;) {
+		page = cache_lookup (inode_get_inumber (inode), ofs);
+		if (page == NULL)
+			page = cache_create (inode, ofs);
+		if (page == NULL || !page->page_cache.loading)
+			break;
+		cond_wait (&load_done, &cache_lock);
+	}
+	if (page == NULL) {
+		lock_release (&cache_lock);
+		return NULL;
+	}
+	page->page_cache.inode = inode;
+	if (vm_pin_resident (page)) {
+		hit_cnt++;
+		page->frame->accessed = true;
+		lock_release (&cache_lock);
+		return page;
+	}
+	miss_cnt++;
+	page->page_cache.loading = true;
+	page->page_cache.advice = advice;
+	lock_release (&cache_lock);
+
+	pinned = vm_pin_page (page);
+
+	lock_acquire (&cache_lock);
+	page->page_cache.loading = false;
+	cond_broadcast (&load_done, &cache_lock);
+	if (pinned)
+		page->frame->accessed = true;
+	lock_release (&cache_lock);
+	return pinned ? page : NULL;
+}
+
+/* Like page_cache_get(), but returns a null pointer instead of
+ * reading the page if it is not resident. */
+struct page *
+page_cache_find (struct inode *inode, off_t ofs) {
+	struct page *page;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	lock_acquire (&cache_lock);
+	page = cache_lookup (inode_get_inumber (inode), ofs);
+	if (page != NULL && (page->page_cache.loading || !vm_pin_resident (page)))
+		page = NULL;
+	if (page != NULL)
+		page->page_cache.inode = inode;
+	lock_release (&cache_lock);
+	return page;
+}
+
+/* Releases PAGE, obtained from page_cache_get() or
+ * page_cache_find(). */
+void
+page_cache_put (struct page *page) {
+	vm_unpin_page (page);
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position
+ * OFFSET, through the cache.  Returns the number of bytes actually
+ * read, which may be less than SIZE if end of file is reached. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
+	uint8_t *buffer = buffer_;
+	off_t bytes_read = 0;
+
+	while (size > 0) {
+		/* Starting byte offset within page. */
+		int page_ofs = offset % PGSIZE;
+		struct page *page;
+
+		/* Bytes left in inode, bytes left in page, lesser of the two. */
+		off_t inode_left = inode_length (inode) - offset;
+		int page_left = PGSIZE - page_ofs;
+		int min_left = inode_left < page_left ? inode_left : page_left;
+
+		/* Number of bytes to actually copy out of this page. */
+		int chunk_size = size < min_left ? size : min_left;
+		if (chunk_size <= 0)
+			break;
+
+		page = page_cache_get (inode, offset - page_ofs, MADV_NORMAL);
+		if (page == NULL)
+			break;
+		memcpy (buffer + bytes_read, (uint8_t *) page->frame->kva + page_ofs,
+				chunk_size);
+		page_cache_put (page);
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_read += chunk_size;
+	}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET,
+ * through the cache; kworkerd writes them to disk later.  Returns
+ * the number of bytes actually written, which may be less than SIZE
+ * if end of file is reached. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t bytes_written = 0;
+
+	while (size > 0) {
+		/* Starting byte offset within page. */
+		int page_ofs = offset % PGSIZE;
+		struct page *page;
+
+		/* Bytes left in inode, bytes left in page, lesser of the two. */
+		off_t inode_left = inode_length (inode) - offset;
+		int page_left = PGSIZE - page_ofs;
+		int min_left = inode_left < page_left ? inode_left : page_left;
+
+		/* Number of bytes to actually write into this page. */
+		int chunk_size = size < min_left ? size : min_left;
+		if (chunk_size <= 0)
+			break;
+
+		page = page_cache_get (inode, offset - page_ofs, MADV_NORMAL);
+		if (page == NULL)
+			break;
+		memcpy ((uint8_t *) page->frame->kva + page_ofs,
+				buffer + bytes_written, chunk_size);
+		page->frame->dirty = true;
+		page_cache_put (page);
+
+		/* Advance. */
+		size -= chunk_size;
+		offset += chunk_size;
+		bytes_written += chunk_size;
+	}
+	if (bytes_written > 0)
+		page_cache_wake_kworkerd (false);
+	return bytes_written;
+}
+
+/* Orders flush entries A and B by disk sector. */
+static int
+flush_entry_cmp (const void *a_, const void *b_) {
+	const struct flush_entry *a = a_;
+	const struct flush_entry *b = b_;
+
+	return a->sector < b->sector ? -1 : a->sector > b->sector;
+}
+
+/* Writes back the dirty pages of INODE, or of every open file if
+ * INODE is null.  The pages go out FLUSH_BATCH at a time, sorted by
+ * the sector they start at, so that the disk head sweeps across each
+ * batch once instead of seeking back and forth between files.
+ * CACHE_LOCK is only held to gather each batch.  Must be called with
+ * FLUSH_LOCK held. */
+static void
+flush_pages (struct inode *inode) {
+	struct list_elem *e;
+
+	ASSERT (lock_held_by_current_thread (&flush_lock));
+
+	lock_acquire (&cache_lock);
+	e = list_begin (&cache_pages);
+	while (e != list_end (&cache_pages)) {
+		size_t cnt = 0, i;
+
+		for (; e != list_end (&cache_pages) && cnt < FLUSH_BATCH;
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page,
+					page_cache.list_elem);
+			struct page_cache *pc = &page->page_cache;
+
+			if (pc->inode == NULL || (inode != NULL && pc->inode != inode))
+				continue;
+			if (vm_clean_page (page)) {
+				flush_batch[cnt].sector = inode_sector_at (pc->inode, pc->ofs);
+				flush_batch[cnt++].page = page;
+			}
+		}
+		lock_release (&cache_lock);
+
+		qsort (flush_batch, cnt, sizeof *flush_batch, flush_entry_cmp);
+		for (i = 0; i < cnt; i++) {
+			write_page (flush_batch[i].page);
+			vm_unpin_page (flush_batch[i].page);
+		}
+		lock_acquire (&cache_lock);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Writes back the pages of INODE's data in the LENGTH bytes from
+ * OFS, a multiple of PGSIZE, that were written since they were last
+ * cleaned, going by the dirty bits of their mappings, in file order.
+ * Clean pages are left alone.  Consecutive dirty pages, up to
+ * PAGE_CACHE_RA_MAX of them, go out together. */
+void
+page_cache_flush_range (struct inode *inode, off_t ofs, off_t length) {
+	disk_sector_t sector = inode_get_inumber (inode);
+	struct page *run[PAGE_CACHE_RA_MAX];
+	off_t end, run_ofs = ofs;
+	size_t cnt = 0;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	lock_acquire (&flush_lock);
+	end = inode_length (inode);
+	if (length < end - ofs)
+		end = ofs + length;
+	for (; ofs < end; ofs += PGSIZE) {
+		struct page *page;
+		bool dirty;
+
+		lock_acquire (&cache_lock);
+		page = cache_lookup (sector, ofs);
+		dirty = page != NULL && page->page_cache.inode == inode
+			&& vm_clean_page (page);
+		lock_release (&cache_lock);
+
+		if (dirty) {
+			if (cnt == 0)
+				run_ofs = ofs;
+			run[cnt++] = page;
+		}
+		if (cnt > 0 && (!dirty || cnt == PAGE_CACHE_RA_MAX)) {
+			write_run (inode, run_ofs, run, cnt);
+			cnt = 0;
+		}
+	}
+	if (cnt > 0)
+		write_run (inode, run_ofs, run, cnt);
+	lock_release (&flush_lock);
+}
+
+/* Reads, or writes if WRITE, the CNT sectors of INODE's data from
+ * OFS, a multiple of DISK_SECTOR_SIZE, straight between the disk and
+ * BUFFERS, sector I going from or to BUFFERS[I], without bringing
+ * them into the cache.  The sectors must lie within the file.  The
+ * cache stays coherent: pages in the range written since they were
+ * last cleaned are written back first, and resident pages take the
+ * data written, which costs a copy only for what is already
+ * cached. */
+void
+page_cache_direct_io (struct inode *inode, off_t ofs, void **buffers,
+		size_t cnt, bool write) {
+	disk_sector_t sector = inode_get_inumber (inode);
+	off_t start = ROUND_DOWN (ofs, PGSIZE);
+	off_t end = ofs + cnt * DISK_SECTOR_SIZE;
+	off_t page_ofs;
+
+	ASSERT (ofs % DISK_SECTOR_SIZE == 0);
+	ASSERT (end <= inode_length (inode));
+
+	page_cache_flush_range (inode, start, end - start);
+	transfer_sectors (inode, ofs, buffers, cnt, write);
+	if (!write)
+		return;
+
+	lock_acquire (&cache_lock);
+	for (page_ofs = start; page_ofs < end; page_ofs += PGSIZE) {
+		struct page *page = cache_lookup (sector, page_ofs);
+		off_t pos = page_ofs > ofs ? page_ofs : ofs;
+
+		if (page == NULL || page->page_cache.inode != inode
+				|| page->page_cache.loading || !vm_pin_resident (page))
+			continue;
+		for (; pos < end && pos < page_ofs + PGSIZE; pos += DISK_SECTOR_SIZE)
+			memcpy ((uint8_t *) page->frame->kva + (pos - page_ofs),
+					buffers[(pos - ofs) / DISK_SECTOR_SIZE], DISK_SECTOR_SIZE);
+		vm_unpin_page (page);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Forgets the cached pages that were evicted, which keep nothing
+ * but readahead history.  Must be called with FLUSH_LOCK and
+ * CACHE_LOCK held. */
+static void
+prune_pages (void) {
+	struct list_elem *e = list_begin (&cache_pages);
+
+	while (e != list_end (&cache_pages)) {
+		struct page *page = list_entry (e, struct page,
+				page_cache.list_elem);
+
+		e = list_next (e);
+		if (page->frame == NULL && !page->page_cache.loading)
+			cache_remove (page);
+	}
+}
+
+/* Called when INODE is closed for the last time.  Writes back its
+ * dirty pages, which stay cached for when the file is opened again,
+ * or, if DISCARD because the file's blocks are about to be freed,
+ * drops all of its pages. */
+void
+page_cache_close (struct inode *inode, bool discard) {
+	disk_sector_t sector = inode_get_inumber (inode);
+	struct list_elem *e;
+
+	lock_acquire (&flush_lock);
+	if (!discard)
+		flush_pages (inode);
+	lock_acquire (&cache_lock);
+	e = list_begin (&cache_pages);
+	while (e != list_end (&cache_pages)) {
+		struct page *page = list_entry (e, struct page,
+				page_cache.list_elem);
+
+		e = list_next (e);
+		if (page->page_cache.sector != sector)
+			continue;
+		if (discard)
+			cache_remove (page);
+		else
+			page->page_cache.inode = NULL;
+	}
+	lock_release (&cache_lock);
+	lock_release (&flush_lock);
+}
+
+/* Writes every dirty page in the cache back to disk.  Does nothing
+ * when called with interrupts off, as on power-off after a panic. */
+void
+page_cache_sync (void) {
+	if (!cache_ready || intr_get_level () == INTR_OFF)
+		return;
+	lock_acquire (&flush_lock);
+	flush_pages (NULL);
+	lock_release (&flush_lock);
+}
+
+/* Wakes kworkerd if it is idle.  Must be called with interrupts
+ * off. */
+static void
+kworkerd_kick (void) {
+	if (kworkerd_idle) {
+		kworkerd_idle = false;
+		sema_up (&kworkerd_sema);
+	}
+}
+
+/* Tells kworkerd that there are dirty pages to write back, right
+ * away if URGENT. */
+void
+page_cache_wake_kworkerd (bool urgent) {
+	enum intr_level old_level = intr_disable ();
+
+	if (!kworkerd_dirty) {
+		kworkerd_dirty = true;
+		kworkerd_dirty_ticks = timer_ticks ();
+	}
+	if (urgent)
+		kworkerd_urgent = true;
+	kworkerd_kick ();
+	intr_set_level (old_level);
+}
+
+/* Queues the PAGE_CNT pages of INODE's data from OFS, which must be
+ * a multiple of PGSIZE, for kworkerd to read into the cache, and
+ * returns without waiting for them.  A range that continues the
+ * last one queued for the same file extends it instead.  This is
+ * only a hint: nothing is queued if out of memory. */
+void
+page_cache_prefetch (struct inode *inode, off_t ofs, size_t page_cnt) {
+	struct prefetch *pf;
+	enum intr_level old_level;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	old_level = intr_disable ();
+	if (!list_empty (&prefetch_queue)) {
+		pf = list_entry (list_back (&prefetch_queue), struct prefetch, elem);
+		if (pf->inode == inode
+				&& pf->ofs + (off_t) (pf->page_cnt * PGSIZE) == ofs) {
+			pf->page_cnt += page_cnt;
+			intr_set_level (old_level);
+			return;
+		}
+	}
+	intr_set_level (old_level);
+
+	pf = malloc (sizeof *pf);
+	if (pf == NULL)
+		return;
+	pf->inode = inode_reopen (inode);
+	pf->ofs = ofs;
+	pf->page_cnt = page_cnt;
+
+	old_level = intr_disable ();
+	list_push_back (&prefetch_queue, &pf->elem);
+	kworkerd_kick ();
+	intr_set_level (old_level);
+}
+
+/* Reads the ranges queued by page_cache_prefetch() into the cache,
+ * a full readahead window at a time. */
+static void
+run_prefetches (void) {
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		struct prefetch *pf = NULL;
+		size_t i;
+
+		if (!list_empty (&prefetch_queue))
+			pf = list_entry (list_pop_front (&prefetch_queue), struct prefetch,
+					elem);
+		intr_set_level (old_level);
+		if (pf == NULL)
+			return;
+
+		for (i = 0; i < pf->page_cnt; i++) {
+			off_t ofs = pf->ofs + i * PGSIZE;
+			struct page *page;
+
+			if (ofs >= inode_length (pf->inode))
+				break;
+			page = page_cache_get (pf->inode, ofs, MADV_SEQUENTIAL);
+			if (page == NULL)
+				break;
+			page_cache_put (page);
+		}
+		inode_close (pf->inode);
+		free (pf);
+	}
 }
 
 /* Worker thread for page cache */
+/* Sleeps until there is work.  Reads queued prefetches in as soon
+ * as they arrive.  Once pages are dirtied, lets more writes to them
+ * gather for FLUSH_DELAY ticks, or less if memory gets short, then
+ * writes back every dirty page and forgets the evicted ones. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		bool flush;
+
+		if (!kworkerd_dirty && list_empty (&prefetch_queue)) {
+			kworkerd_idle = true;
+			sema_down (&kworkerd_sema);
+		}
+		flush = kworkerd_dirty && (kworkerd_urgent
+				|| timer_elapsed (kworkerd_dirty_ticks) >= FLUSH_DELAY);
+		if (flush) {
+			kworkerd_dirty = false;
+			kworkerd_urgent = false;
+		}
+		intr_set_level (old_level);
+
+		run_prefetches ();
+		if (flush) {
+			lock_acquire (&flush_lock);
+			flush_pages (NULL);
+			lock_acquire (&cache_lock);
+			prune_pages ();
+			lock_release (&cache_lock);
+			lock_release (&flush_lock);
+		} else if (kworkerd_dirty)
+			timer_sleep (FLUSH_SLICE);
+	}
 }
+#endif /* VM */
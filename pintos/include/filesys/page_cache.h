@@ -1,12 +1,48 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
+#include <hash.h>
+#include <list.h>
+#include "devices/disk.h"
+#include "filesys/off_t.h"
 #include "vm/vm.h"
 
 struct page;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* Largest readahead window, in pages. */
+#define PAGE_CACHE_RA_MAX 32
+
+/* A page of file data in the page cache.
+ * The cache is indexed by (inode sector, page offset), so pages outlive
+ * the in-memory inode and are found again when the file is reopened. */
+struct page_cache {
+	disk_sector_t sector;        /* Inode sector of the cached file. */
+	struct inode *inode;         /* The file while it is open, else NULL. */
+	off_t ofs;                   /* Offset of the page in the file. */
+	unsigned ra_window;          /* Size of the read that brought it in. */
+	int advice;                  /* MADV_* advice of the access reading
+	                                it in. */
+	bool loading;                /* Being read in; lookups wait. */
+	struct hash_elem hash_elem;  /* Element in the cache index. */
+	struct list_elem list_elem;  /* Element in the list of cached pages. */
+};
 
 void page_cache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+struct page *page_cache_get (struct inode *inode, off_t ofs, int advice);
+struct page *page_cache_find (struct inode *inode, off_t ofs);
+void page_cache_put (struct page *page);
+off_t page_cache_read (struct inode *inode, void *buffer, off_t size,
+		off_t offset);
+off_t page_cache_write (struct inode *inode, const void *buffer, off_t size,
+		off_t offset);
+void page_cache_prefetch (struct inode *inode, off_t ofs, size_t page_cnt);
+void page_cache_flush_range (struct inode *inode, off_t ofs, off_t length);
+void page_cache_direct_io (struct inode *inode, off_t ofs, void **buffers,
+		size_t cnt, bool write);
+void page_cache_close (struct inode *inode, bool discard);
+void page_cache_sync (void);
+void page_cache_wake_kworkerd (bool urgent);
+void page_cache_print_stats (void);
 #endif
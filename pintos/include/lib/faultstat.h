@@ -0,0 +1,39 @@
+#ifndef __LIB_FAULTSTAT_H
+#define __LIB_FAULTSTAT_H
+
+/* What a page fault had to do. */
+enum fault_cause {
+	FAULT_LAZY,                 /* Load an executable page on first touch. */
+	FAULT_ZERO,                 /* Zero-fill an anonymous page. */
+	FAULT_SWAP,                 /* Bring an anonymous page back from swap. */
+	FAULT_COW,                  /* Copy a page shared copy-on-write. */
+	FAULT_STACK,                /* Grow the stack. */
+	FAULT_FILE,                 /* Map or dirty a page of a mapped file. */
+	FAULT_INVALID,              /* Nothing: the access was invalid. */
+	FAULT_CAUSE_CNT
+};
+
+/* Fault latency histogram.  Bucket I counts the faults that took
+   fewer than 1 << (FAULT_HIST_SHIFT + I) CPU cycles and did not fit
+   a lower bucket; the last bucket also counts all slower ones. */
+#define FAULT_HIST_SHIFT 12
+#define FAULT_HIST_CNT 12
+
+/* Statistics of the faults of one cause. */
+struct fault_class_stats {
+	unsigned long long cnt;     /* Number of faults. */
+	unsigned long long io_cnt;  /* Disk sectors moved while handling them. */
+	unsigned long long cycles;  /* CPU cycles spent handling them. */
+	unsigned hist[FAULT_HIST_CNT];  /* Latency histogram. */
+};
+
+/* Page fault statistics, indexed by enum fault_cause. */
+struct fault_stats {
+	struct fault_class_stats causes[FAULT_CAUSE_CNT];
+};
+
+/* Whose statistics faultstat() returns. */
+#define FAULTSTAT_SELF 0        /* The calling process's. */
+#define FAULTSTAT_ALL 1         /* All processes' since boot. */
+
+#endif /* lib/faultstat.h */
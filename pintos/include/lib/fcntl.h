@@ -0,0 +1,10 @@
+#ifndef __LIB_FCNTL_H
+#define __LIB_FCNTL_H
+
+/* Flags for open_flags(). */
+#define O_DIRECT 0x4000         /* Move data straight between the disk
+                                   and user memory, bypassing the page
+                                   cache, when reads and writes are
+                                   sector-aligned and at least a page. */
+
+#endif /* lib/fcntl.h */
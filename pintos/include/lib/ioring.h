@@ -0,0 +1,47 @@
+#ifndef __LIB_IORING_H
+#define __LIB_IORING_H
+
+#include <stdint.h>
+
+/* Entries in each of the rings of a struct io_ring. */
+#define IORING_ENTRIES 32
+
+/* Largest read or write one submission may ask for. */
+#define IORING_IO_MAX 16384
+
+/* Operations. */
+#define IORING_OP_NOP 0         /* Do nothing. */
+#define IORING_OP_OPEN 1        /* Open the file named by BUF. */
+#define IORING_OP_READ 2        /* Read LEN bytes at OFFSET into BUF. */
+#define IORING_OP_WRITE 3       /* Write LEN bytes at OFFSET from BUF. */
+#define IORING_OP_CLOSE 4       /* Close FD. */
+
+/* A submission: an operation for the kernel to carry out. */
+struct io_sqe {
+	int opcode;                 /* IORING_OP_*. */
+	int fd;                     /* File for READ, WRITE and CLOSE. */
+	void *buf;                  /* Data, or the file name for OPEN. */
+	unsigned len;               /* Bytes to read or write. */
+	int offset;                 /* File offset to read or write at. */
+	uint64_t user_data;         /* Handed back in the completion. */
+};
+
+/* A completion: the outcome of a submission. */
+struct io_cqe {
+	uint64_t user_data;         /* From the submission. */
+	int res;                    /* Bytes moved, new fd, 0, or -1. */
+};
+
+/* A submission ring and a completion ring in user memory, set up
+   with ioring_setup().  The process adds submissions at SQ_TAIL and
+   takes completions from CQ_HEAD; ioring_enter() consumes
+   submissions from SQ_HEAD and adds completions at CQ_TAIL.  The
+   counters only grow; entry I of a ring is at I % IORING_ENTRIES. */
+struct io_ring {
+	unsigned sq_head, sq_tail;
+	unsigned cq_head, cq_tail;
+	struct io_sqe sq[IORING_ENTRIES];
+	struct io_cqe cq[IORING_ENTRIES];
+};
+
+#endif /* lib/ioring.h */
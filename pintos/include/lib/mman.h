@@ -0,0 +1,15 @@
+#ifndef __LIB_MMAN_H
+#define __LIB_MMAN_H
+
+/* Flag that may be or'd into the WRITABLE argument of mmap(): reads
+   the whole mapping in before returning, instead of on demand. */
+#define MAP_POPULATE 0x8000
+
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random accesses. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential accesses. */
+#define MADV_WILLNEED 3         /* Will need these pages soon. */
+#define MADV_DONTNEED 4         /* Won't need these pages for now. */
+
+#endif /* lib/mman.h */
@@ -36,6 +36,22 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_MSYNC,                  /* Write back a mapped memory range. */
+	SYS_FAULTSTAT,              /* Get page fault statistics. */
+
+	/* Extra process creation. */
+	SYS_SPAWN,                  /* Start a process from an executable. */
+	SYS_VFORK,                  /* Clone without copying memory. */
+
+	/* Extra asynchronous I/O. */
+	SYS_IORING_SETUP,           /* Set up submission and completion rings. */
+	SYS_IORING_ENTER,           /* Submit and reap through the rings. */
+
+	/* Extra direct I/O. */
+	SYS_OPEN_FLAGS,             /* Open a file with O_* flags. */
 };
 
 #endif /* lib/syscall-nr.h */
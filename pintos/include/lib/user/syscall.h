@@ -4,6 +4,10 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include <faultstat.h>
+#include <fcntl.h>
+#include <ioring.h>
+#include <mman.h>
 
 /* Process identifier. */
 typedef int pid_t;
@@ -29,6 +33,7 @@ int wait (pid_t);
 bool create (const char *file, unsigned initial_size);
 bool remove (const char *file);
 int open (const char *file);
+int open_flags (const char *file, int flags);
 int filesize (int fd);
 int read (int fd, void *buffer, unsigned length);
 int write (int fd, const void *buffer, unsigned length);
@@ -37,10 +42,17 @@ unsigned tell (int fd);
 void close (int fd);
 
 int dup2(int oldfd, int newfd);
+pid_t spawn (const char *file);
+pid_t vfork (const char *thread_name);
+int ioring_setup (struct io_ring *ring);
+int ioring_enter (unsigned min_complete);
 
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int madvise (void *addr, size_t length, int advice);
+int msync (void *addr, size_t length);
+int faultstat (int who, struct fault_stats *stats);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -41,5 +41,16 @@
 #define PTE_U 0x4                        /* 1=user/kernel, 0=kernel only. */
 #define PTE_A 0x20                       /* 1=accessed, 0=not acccessed. */
 #define PTE_D 0x40                       /* 1=dirty, 0=not dirty (PTEs only). */
+#define PTE_PS 0x80                      /* 1=large page leaf (PDEs, PDPEs). */
+#define PTE_G 0x100                      /* 1=global, survives CR3 loads. */
+
+/* Large pages.  A PDE with PTE_PS set maps a 2 MiB page directly,
+   and a PDPE with PTE_PS set maps a 1 GiB page.  Their accessed
+   and dirty bits sit at the same positions as in a PTE. */
+#define LARGE_PGSIZE (1UL << PDXSHIFT)   /* Bytes in a 2 MiB page. */
+#define LARGE_PGMASK (LARGE_PGSIZE - 1)  /* Offset bits of a 2 MiB page. */
+#define HUGE_PGSIZE (1UL << PDPESHIFT)   /* Bytes in a 1 GiB page. */
+#define HUGE_PGMASK (HUGE_PGSIZE - 1)    /* Offset bits of a 1 GiB page. */
+#define LARGE_PGCNT (LARGE_PGSIZE / PGSIZE) /* 4 kB pages per 2 MiB page. */
 
 #endif /* threads/pte.h */
@@ -5,6 +5,7 @@
 #include <list.h>
 #include <stdint.h>
 #include "threads/interrupt.h"
+#include "threads/synch.h"
 #ifdef VM
 #include "vm/vm.h"
 #endif
@@ -43,13 +44,29 @@ struct thread
 	struct list_elem elem; /* List element. */
 	int64_t wakeup_tick;	 /* Wakeup tick. */
 
+	/* Shared between thread.c and devices/disk.c. */
+	long long disk_cnt; /* Disk sectors read or written by this thread. */
+
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4; /* Page map level 4 */
+	struct file *exec_file; /* Running executable, kept open. */
+	struct file **fd_table; /* Open files by descriptor, or NULL. */
+	struct ioring *ioring;  /* I/O rings from ioring_setup(), or NULL. */
+	struct thread *vfork_parent;  /* Whose address space this borrows. */
+	struct semaphore *vfork_done; /* Up'd when giving it back. */
+	uint64_t user_rsp;      /* User stack pointer at system call entry. */
+	int exit_status;        /* Status for process_wait(). */
+	struct list children;   /* Threads this one created, not yet reaped. */
+	struct list_elem child_elem;  /* In the creator's CHILDREN. */
+	struct semaphore exit_sema;   /* Up'd when this thread has exited. */
+	struct semaphore reap_sema;   /* Up'd when its creator is done with it. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
+	/* Page fault statistics, or NULL before the first fault. */
+	struct fault_stats *fault_stats;
 #endif
 
 	/* Owned by thread.c. */
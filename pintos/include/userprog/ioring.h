@@ -0,0 +1,11 @@
+#ifndef USERPROG_IORING_H
+#define USERPROG_IORING_H
+
+#include <ioring.h>
+
+void ioring_init (void);
+int ioring_setup (struct io_ring *uring);
+int ioring_enter (unsigned min_complete);
+void ioring_destroy (void);
+
+#endif /* userprog/ioring.h */
@@ -5,9 +5,14 @@
 
 tid_t process_create_initd (const char *file_name);
 tid_t process_fork (const char *name, struct intr_frame *if_);
+tid_t process_vfork (const char *name, struct intr_frame *if_);
+tid_t process_spawn (const char *file_name);
 int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
+int process_add_file (struct file *file);
+struct file *process_get_file (int fd);
+void process_close_file (int fd);
 
 #endif /* userprog/process.h */
@@ -2,12 +2,31 @@
 #define VM_ANON_H
 #include "vm/vm.h"
 struct page;
+struct zswap_entry;
 enum vm_type;
 
 struct anon_page {
+	size_t slot;                /* Swap slot holding the page, or SWAP_NONE. */
+	struct zswap_entry *zswap;  /* Compressed copy of the page, or NULL. */
+	bool ra;                    /* Read ahead from swap, not used since. */
 };
 
+/* No swap slot. */
+#define SWAP_NONE ((size_t) -1)
+
+/* Most pages swapped out together in one cluster. */
+#define SWAP_CLUSTER 8
+
+/* Most pages a swap-in fault reads, the faulting one included. */
+#define SWAP_RA_MAX 8
+
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+bool anon_swap_out_cluster (struct page **pages, size_t cnt);
+size_t anon_swap_ra_window (void);
+void anon_swap_in_cluster (struct page **pages, size_t cnt,
+		struct page *page);
+void anon_ra_used (struct page *page, bool used);
+void vm_anon_print_stats (void);
 
 #endif
@@ -4,14 +4,30 @@
 #include "vm/vm.h"
 
 struct page;
+struct vma;
 enum vm_type;
 
+/* A file mapped by one do_mmap() call. */
+struct mmap_file {
+	struct file *file;           /* The mapping's own handle on the file. */
+	void *addr;                  /* First mapped page. */
+	int ref_cnt;                 /* # of areas and pages referring to it. */
+};
+
 struct file_page {
+	struct mmap_file *map;       /* Mapping the page belongs to. */
+	off_t ofs;                   /* Offset of the page in the file. */
 };
 
 void vm_file_init (void);
 bool file_backed_initializer (struct page *page, enum vm_type type, void *kva);
+bool file_backed_claim (struct page *page, bool io);
+void file_backed_prefetch (struct vma *vma, void *start, void *end);
+void file_backed_sync (struct vma *vma, void *start, void *end);
+void mmap_file_get (struct mmap_file *map);
+void mmap_file_put (struct mmap_file *map);
 void *do_mmap(void *addr, size_t length, int writable,
 		struct file *file, off_t offset);
 void do_munmap (void *va);
+int do_msync (void *addr, size_t length);
 #endif
@@ -1,6 +1,10 @@
 #ifndef VM_VM_H
 #define VM_VM_H
 #include <stdbool.h>
+#include <hash.h>
+#include <list.h>
+#include <faultstat.h>
+#include <mman.h>
 #include "threads/palloc.h"
 
 enum vm_type {
@@ -27,9 +31,8 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
+#include "vm/vma.h"
 #include "filesys/page_cache.h"
-#endif
 
 struct page_operations;
 struct thread;
@@ -46,6 +49,10 @@ struct page {
 	struct frame *frame;   /* Back reference for frame */
 
 	/* Your implementation */
+	struct thread *owner;        /* Thread whose pml4 maps VA. */
+	bool writable;               /* May the owner write to VA? */
+	int advice;                  /* MADV_* advice from madvise(). */
+	struct list_elem frame_elem; /* Element in frame->pages. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -53,16 +60,28 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 
-/* The representation of "frame" */
+/* The representation of "frame".
+ * A frame is mapped by one or more pages, kept in PAGES; PAGE is the
+ * first of them and the one that is swapped in and out.  A page cache
+ * frame holds its cache page first, followed by the file mappings
+ * sharing it. */
 struct frame {
 	void *kva;
 	struct page *page;
+	struct list pages;           /* Pages mapping this frame. */
+	struct list_elem elem;       /* Element in the frame table. */
+	int pin_cnt;                 /* Not evictable while nonzero. */
+	bool evicting;               /* Being written out by eviction. */
+	bool dirty;                  /* Written through a mapping since loaded. */
+	bool accessed;               /* Used by the kernel since the clock passed. */
+	uint64_t checksum;           /* Contents when ksmd last looked. */
+	bool ksm;                    /* Pages were merged into it by ksmd. */
+	bool ksm_indexed;            /* In ksmd's index of stable frames. */
+	struct hash_elem ksm_elem;   /* Element in ksmd's index. */
 };
 
 /* The function table for page operations.
@@ -82,9 +101,14 @@ struct page_operations {
 	if ((page)->operations->destroy) (page)->operations->destroy (page)
 
 /* Representation of current process's memory space.
- * We don't want to force you to obey any specific design for this struct.
- * All designs up to you for this. */
+ * The address space is made of areas, struct vma, which say where
+ * the pages in a range come from; a page is only created once it is
+ * touched.  Pages that exist are kept in a radix tree indexed by
+ * page number, whose nodes are struct spt_node. */
+struct spt_node;
 struct supplemental_page_table {
+	struct vma *vmas;            /* Areas, in a tree by address. */
+	struct spt_node *pages;      /* Pages, in a radix tree by page number. */
 };
 
 #include "threads/thread.h"
@@ -96,8 +120,26 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 		void *va);
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
+struct page *spt_next_page (struct supplemental_page_table *spt,
+		const void *va, const void *end);
+void spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end);
+
+/* Maximum size of the user stack. */
+#define STACK_MAX (1 << 20)
+
+/* Most pages a single fault resolves; see vm_fault_around. */
+#define FAULT_AROUND_MAX 16
+extern size_t vm_fault_around;
+
+/* Frames ksmd scans per pass, or 0 if it is off; see ksmd. */
+extern size_t vm_ksm_pages;
+
+/* Print each process's page fault statistics at exit?  Set with -fs. */
+extern bool vm_print_faults;
 
 void vm_init (void);
+struct thread *vm_owner (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
 
@@ -107,6 +149,19 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_pin_page (struct page *page);
+bool vm_pin_resident (struct page *page);
+void vm_unpin_page (struct page *page);
+bool vm_pin_range (const void *addr, size_t size, bool write);
+void vm_unpin_range (const void *addr, size_t size);
+void vm_free_frame (struct page *page);
+bool vm_reserve_frame (struct page *page);
+bool vm_share_frame (struct page *dst_page, struct page *src_page);
+bool vm_clean_page (struct page *page);
+int vm_madvise (void *addr, size_t length, int advice);
+int vm_faultstat (int who, struct fault_stats *stats);
+void vm_print_fault_stats (const char *who, const struct fault_stats *stats);
 enum vm_type page_get_type (struct page *page);
+void vm_print_stats (void);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,47 @@
+#ifndef VM_VMA_H
+#define VM_VMA_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "filesys/off_t.h"
+
+struct mmap_file;
+struct supplemental_page_table;
+
+/* A virtual memory area: a run of pages of a process that come from
+ * the same place and share permissions and advice.  The pages are
+ * created from their area the first time they are touched. */
+struct vma {
+	uint8_t *start;              /* First page. */
+	uint8_t *end;                /* Page past the last. */
+	bool writable;               /* May the pages be written? */
+	bool stack;                  /* The stack, which grows on faults. */
+	int advice;                  /* MADV_* advice from madvise(). */
+
+	/* Creates the pending page at VA, which lies in VMA, in the
+	 * current process.  Null for the stack. */
+	bool (*alloc_page) (struct vma *vma, void *va);
+	struct mmap_file *map;       /* File mapping, or NULL. */
+	off_t ofs;                   /* File offset of START. */
+	size_t read_bytes;           /* Executable segment: bytes read from
+	                                the file; the rest are zeros. */
+
+	uint64_t prio;               /* Treap priority. */
+	struct vma *left;            /* Areas below this one. */
+	struct vma *right;           /* Areas above this one. */
+};
+
+struct vma *vma_create (struct supplemental_page_table *spt, void *start,
+		void *end, bool writable);
+struct vma *vma_find (struct supplemental_page_table *spt, const void *va);
+struct vma *vma_next (struct supplemental_page_table *spt, const void *va);
+bool vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end);
+struct vma *vma_split (struct supplemental_page_table *spt, struct vma *vma,
+		void *va);
+void vma_remove (struct supplemental_page_table *spt, struct vma *vma);
+bool vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+void vma_kill (struct supplemental_page_table *spt);
+
+#endif
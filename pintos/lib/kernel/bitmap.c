@@ -3,6 +3,8 @@
 #include <limits.h>
 #include <round.h>
 #include <stdio.h>
+#include <string.h>
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
 #ifdef FILESYS
 #include "filesys/file.h"
@@ -23,10 +25,20 @@ typedef unsigned long elem_type;
 
 /* From the outside, a bitmap is an array of bits.  From the
    inside, it's an array of elem_type (defined above) that
-   simulates an array of bits. */
+   simulates an array of bits.
+
+   Most operations work a whole element at a time.  A bitmap may
+   also carry a summary level: two more bit arrays with one bit
+   per element, telling whether that element is all ones (FULL)
+   or all zeros (EMPTY).  Scans skip ELEM_BITS elements, that is
+   ELEM_BITS * ELEM_BITS bits, per summary element, which keeps
+   searches in nearly full or nearly empty bitmaps short.  The
+   summary is kept in step with the bits with interrupts off. */
 struct bitmap {
 	size_t bit_cnt;     /* Number of bits. */
 	elem_type *bits;    /* Elements that represent bits. */
+	elem_type *full;    /* Summary: element is all ones, or NULL. */
+	elem_type *empty;   /* Summary: element is all zeros, or NULL. */
 };
 
 /* Returns the index of the element that contains the bit
@@ -62,6 +74,152 @@ last_mask (const struct bitmap *b) {
 	int last_bits = b->bit_cnt % ELEM_BITS;
 	return last_bits ? ((elem_type) 1 << last_bits) - 1 : (elem_type) -1;
 }
+
+/* Returns an elem_type with the bits for bit indexes START
+   through END - 1 within a single element turned on.  END may
+   be at most the start of the next element. */
+static inline elem_type
+range_mask (size_t start, size_t end) {
+	elem_type hi = end % ELEM_BITS == 0 ? (elem_type) -1 : bit_mask (end) - 1;
+	return hi & ~(bit_mask (start) - 1);
+}
+
+/* Returns the number of bytes in each summary array of a bitmap
+   with BIT_CNT bits. */
+static inline size_t
+summary_byte_cnt (size_t bit_cnt) {
+	return byte_cnt (elem_cnt (bit_cnt));
+}
+
+/* Returns the number of 1 bits in W.  GCC would call into
+   libgcc for __builtin_popcountl(), which Pintos lacks. */
+static inline size_t
+popcount (elem_type w) {
+	w = w - ((w >> 1) & 0x5555555555555555UL);
+	w = (w & 0x3333333333333333UL) + ((w >> 2) & 0x3333333333333333UL);
+	w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fUL;
+	return (w * 0x0101010101010101UL) >> 56;
+}
+
+/* Returns the index of the lowest 1 bit in W, which must be
+   nonzero. */
+static inline size_t
+lowest_bit (elem_type w) {
+	return __builtin_ctzl (w);
+}
+
+/* Recomputes the summary bits for element IDX of B.  Must be
+   called with interrupts off. */
+static inline void
+update_summary (struct bitmap *b, size_t idx) {
+	elem_type w = b->bits[idx];
+	size_t s = elem_idx (idx);
+	elem_type m = bit_mask (idx);
+
+	if (w == (elem_type) -1)
+		b->full[s] |= m;
+	else
+		b->full[s] &= ~m;
+	if (w == 0)
+		b->empty[s] |= m;
+	else
+		b->empty[s] &= ~m;
+}
+
+/* Recomputes the whole summary of B, if it has one. */
+static void
+rebuild_summary (struct bitmap *b) {
+	if (b->full != NULL) {
+		enum intr_level old_level = intr_disable ();
+		size_t i;
+
+		memset (b->full, 0, summary_byte_cnt (b->bit_cnt));
+		memset (b->empty, 0, summary_byte_cnt (b->bit_cnt));
+		for (i = 0; i < elem_cnt (b->bit_cnt); i++)
+			update_summary (b, i);
+		intr_set_level (old_level);
+	}
+}
+
+/* Atomically applies `b->bits[IDX] |= MASK', `&= MASK' or
+   `^= MASK', keeping the summary of B in step.  Each is
+   guaranteed to be atomic on a uniprocessor machine; see the
+   description of the OR, AND and XOR instructions in [IA32-v2a]
+   and [IA32-v2b]. */
+static void
+elem_or (struct bitmap *b, size_t idx, elem_type mask) {
+	enum intr_level old_level = b->full ? intr_disable () : INTR_OFF;
+	asm ("lock orq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (b->full) {
+		update_summary (b, idx);
+		intr_set_level (old_level);
+	}
+}
+
+static void
+elem_and (struct bitmap *b, size_t idx, elem_type mask) {
+	enum intr_level old_level = b->full ? intr_disable () : INTR_OFF;
+	asm ("lock andq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (b->full) {
+		update_summary (b, idx);
+		intr_set_level (old_level);
+	}
+}
+
+static void
+elem_xor (struct bitmap *b, size_t idx, elem_type mask) {
+	enum intr_level old_level = b->full ? intr_disable () : INTR_OFF;
+	asm ("lock xorq %1, %0" : "+m" (b->bits[idx]) : "r" (mask) : "cc");
+	if (b->full) {
+		update_summary (b, idx);
+		intr_set_level (old_level);
+	}
+}
+
+/* Returns the index of the first element of B at or after IDX
+   that SKIP does not mark as uninteresting, or an index past
+   the last element if there is none.  SKIP is one of B's summary
+   arrays, or a null pointer to visit every element. */
+static size_t
+next_elem (const struct bitmap *b, const elem_type *skip, size_t idx) {
+	size_t cnt = elem_cnt (b->bit_cnt);
+
+	if (skip == NULL)
+		return idx;
+	while (idx < cnt) {
+		size_t s = elem_idx (idx);
+		elem_type candidates = ~skip[s] & ~(bit_mask (idx) - 1);
+		if (candidates != 0)
+			return s * ELEM_BITS + lowest_bit (candidates);
+		idx = (s + 1) * ELEM_BITS;
+	}
+	return idx;
+}
+
+/* Returns the index of the first bit in B in [START, END) that
+   is set to VALUE, or END if there is none. */
+static size_t
+find_bit (const struct bitmap *b, size_t start, size_t end, bool value) {
+	const elem_type flip = value ? 0 : (elem_type) -1;
+	const elem_type *skip = value ? b->empty : b->full;
+	size_t idx, bit;
+	elem_type w;
+
+	if (start >= end)
+		return end;
+
+	/* W has a 1 for every bit equal to VALUE. */
+	idx = elem_idx (start);
+	w = (b->bits[idx] ^ flip) & ~(bit_mask (start) - 1);
+	while (w == 0) {
+		idx = next_elem (b, skip, idx + 1);
+		if (idx * ELEM_BITS >= end)
+			return end;
+		w = b->bits[idx] ^ flip;
+	}
+	bit = idx * ELEM_BITS + lowest_bit (w);
+	return bit < end ? bit : end;
+}
 
 /* Creation and destruction. */
 
@@ -74,6 +232,7 @@ bitmap_create (size_t bit_cnt) {
 	struct bitmap *b = malloc (sizeof *b);
 	if (b != NULL) {
 		b->bit_cnt = bit_cnt;
+		b->full = b->empty = NULL;
 		b->bits = malloc (byte_cnt (bit_cnt));
 		if (b->bits != NULL || bit_cnt == 0) {
 			bitmap_set_all (b, false);
@@ -84,6 +243,24 @@ bitmap_create (size_t bit_cnt) {
 	return NULL;
 }
 
+/* Like bitmap_create(), but the bitmap also keeps a summary
+   level that speeds up scans and bitmap_contains() over large,
+   mostly full or mostly empty bitmaps. */
+struct bitmap *
+bitmap_create_with_summary (size_t bit_cnt) {
+	struct bitmap *b = bitmap_create (bit_cnt);
+	if (b != NULL) {
+		b->full = malloc (2 * summary_byte_cnt (bit_cnt));
+		if (b->full != NULL || bit_cnt == 0) {
+			b->empty = b->full + elem_cnt (elem_cnt (bit_cnt));
+			rebuild_summary (b);
+			return b;
+		}
+		bitmap_destroy (b);
+	}
+	return NULL;
+}
+
 /* Creates and returns a bitmap with BIT_CNT bits in the
    BLOCK_SIZE bytes of storage preallocated at BLOCK.
    BLOCK_SIZE must be at least bitmap_needed_bytes(BIT_CNT). */
@@ -95,10 +272,30 @@ bitmap_create_in_buf (size_t bit_cnt, void *block, size_t block_size UNUSED) {
 
 	b->bit_cnt = bit_cnt;
 	b->bits = (elem_type *) (b + 1);
+	b->full = b->empty = NULL;
 	bitmap_set_all (b, false);
 	return b;
 }
 
+/* Like bitmap_create_in_buf(), but with a summary level (see
+   bitmap_create_with_summary()).  BLOCK_SIZE must be at least
+   bitmap_summary_buf_size(BIT_CNT). */
+struct bitmap *
+bitmap_create_with_summary_in_buf (size_t bit_cnt, void *block,
+		size_t block_size UNUSED) {
+	struct bitmap *b = block;
+
+	ASSERT (block_size >= bitmap_summary_buf_size (bit_cnt));
+
+	b->bit_cnt = bit_cnt;
+	b->bits = (elem_type *) (b + 1);
+	b->full = b->bits + elem_cnt (bit_cnt);
+	b->empty = b->full + elem_cnt (elem_cnt (bit_cnt));
+	memset (b->bits, 0, byte_cnt (bit_cnt));
+	rebuild_summary (b);
+	return b;
+}
+
 /* Returns the number of bytes required to accomodate a bitmap
    with BIT_CNT bits (for use with bitmap_create_in_buf()). */
 size_t
@@ -106,12 +303,21 @@ bitmap_buf_size (size_t bit_cnt) {
 	return sizeof (struct bitmap) + byte_cnt (bit_cnt);
 }
 
+/* Returns the number of bytes required to accomodate a bitmap
+   with BIT_CNT bits and a summary level (for use with
+   bitmap_create_with_summary_in_buf()). */
+size_t
+bitmap_summary_buf_size (size_t bit_cnt) {
+	return bitmap_buf_size (bit_cnt) + 2 * summary_byte_cnt (bit_cnt);
+}
+
 /* Destroys bitmap B, freeing its storage.
    Not for use on bitmaps created by
    bitmap_create_preallocated(). */
 void
 bitmap_destroy (struct bitmap *b) {
 	if (b != NULL) {
+		free (b->full);
 		free (b->bits);
 		free (b);
 	}
@@ -141,25 +347,13 @@ bitmap_set (struct bitmap *b, size_t idx, bool value) {
 /* Atomically sets the bit numbered BIT_IDX in B to true. */
 void
 bitmap_mark (struct bitmap *b, size_t bit_idx) {
-	size_t idx = elem_idx (bit_idx);
-	elem_type mask = bit_mask (bit_idx);
-
-	/* This is equivalent to `b->bits[idx] |= mask' except that it
-	   is guaranteed to be atomic on a uniprocessor machine.  See
-	   the description of the OR instruction in [IA32-v2b]. */
-	asm ("lock orq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	elem_or (b, elem_idx (bit_idx), bit_mask (bit_idx));
 }
 
 /* Atomically sets the bit numbered BIT_IDX in B to false. */
 void
 bitmap_reset (struct bitmap *b, size_t bit_idx) {
-	size_t idx = elem_idx (bit_idx);
-	elem_type mask = bit_mask (bit_idx);
-
-	/* This is equivalent to `b->bits[idx] &= ~mask' except that it
-	   is guaranteed to be atomic on a uniprocessor machine.  See
-	   the description of the AND instruction in [IA32-v2a]. */
-	asm ("lock andq %1, %0" : "=m" (b->bits[idx]) : "r" (~mask) : "cc");
+	elem_and (b, elem_idx (bit_idx), ~bit_mask (bit_idx));
 }
 
 /* Atomically toggles the bit numbered IDX in B;
@@ -167,13 +361,7 @@ bitmap_reset (struct bitmap *b, size_t bit_idx) {
    and if it is false, makes it true. */
 void
 bitmap_flip (struct bitmap *b, size_t bit_idx) {
-	size_t idx = elem_idx (bit_idx);
-	elem_type mask = bit_mask (bit_idx);
-
-	/* This is equivalent to `b->bits[idx] ^= mask' except that it
-	   is guaranteed to be atomic on a uniprocessor machine.  See
-	   the description of the XOR instruction in [IA32-v2b]. */
-	asm ("lock xorq %1, %0" : "=m" (b->bits[idx]) : "r" (mask) : "cc");
+	elem_xor (b, elem_idx (bit_idx), bit_mask (bit_idx));
 }
 
 /* Returns the value of the bit numbered IDX in B. */
@@ -194,50 +382,66 @@ bitmap_set_all (struct bitmap *b, bool value) {
 	bitmap_set_multiple (b, 0, bitmap_size (b), value);
 }
 
-/* Sets the CNT bits starting at START in B to VALUE. */
+/* Sets the CNT bits starting at START in B to VALUE.
+   Each element is updated atomically, but the group as a whole
+   is not. */
 void
 bitmap_set_multiple (struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
+	size_t end = start + cnt;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		bitmap_set (b, start + i, value);
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t elem_end = (idx + 1) * ELEM_BITS < end ? (idx + 1) * ELEM_BITS : end;
+		elem_type mask = range_mask (start, elem_end);
+
+		if (value)
+			elem_or (b, idx, mask);
+		else
+			elem_and (b, idx, ~mask);
+		start = elem_end;
+	}
 }
 
 /* Returns the number of bits in B between START and START + CNT,
    exclusive, that are set to VALUE. */
 size_t
 bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i, value_cnt;
+	size_t end = start + cnt;
+	size_t ones = 0;
 
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	value_cnt = 0;
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			value_cnt++;
-	return value_cnt;
+	while (start < end) {
+		size_t idx = elem_idx (start);
+		size_t elem_end = (idx + 1) * ELEM_BITS < end ? (idx + 1) * ELEM_BITS : end;
+		elem_type mask = range_mask (start, elem_end);
+
+		if (mask == (elem_type) -1 && b->full != NULL
+				&& (b->full[elem_idx (idx)] & bit_mask (idx)))
+			ones += ELEM_BITS;
+		else if (mask != (elem_type) -1 || b->empty == NULL
+				|| !(b->empty[elem_idx (idx)] & bit_mask (idx)))
+			ones += popcount (b->bits[idx] & mask);
+		start = elem_end;
+	}
+	return value ? ones : cnt - ones;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
    exclusive, are set to VALUE, and false otherwise. */
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) {
-	size_t i;
-
 	ASSERT (b != NULL);
 	ASSERT (start <= b->bit_cnt);
 	ASSERT (start + cnt <= b->bit_cnt);
 
-	for (i = 0; i < cnt; i++)
-		if (bitmap_test (b, start + i) == value)
-			return true;
-	return false;
+	return find_bit (b, start, start + cnt, value) < start + cnt;
 }
 
 /* Returns true if any bits in B between START and START + CNT,
@@ -274,10 +478,21 @@ bitmap_scan (const struct bitmap *b, size_t start, size_t cnt, bool value) {
 
 	if (cnt <= b->bit_cnt) {
 		size_t last = b->bit_cnt - cnt;
-		size_t i;
-		for (i = start; i <= last; i++)
-			if (!bitmap_contains (b, i, cnt, !value))
+		size_t i = start;
+		while (i <= last) {
+			/* Jump to the next bit set to VALUE, then to the first
+			   bit that breaks the run starting there, if any. */
+			size_t end;
+			if (cnt == 0)
 				return i;
+			i = find_bit (b, i, last + 1, value);
+			if (i > last)
+				break;
+			end = find_bit (b, i, i + cnt, !value);
+			if (end == i + cnt)
+				return i;
+			i = end;
+		}
 	}
 	return BITMAP_ERROR;
 }
@@ -315,6 +530,7 @@ bitmap_read (struct bitmap *b, struct file *file) {
 		off_t size = byte_cnt (b->bit_cnt);
 		success = file_read_at (file, b->bits, size, 0) == size;
 		b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
+		rebuild_summary (b);
 	}
 	return success;
 }
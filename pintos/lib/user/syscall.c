@@ -90,6 +90,37 @@ exec (const char *file) {
 	return (pid_t) syscall1 (SYS_EXEC, file);
 }
 
+pid_t
+spawn (const char *file) {
+	return (pid_t) syscall1 (SYS_SPAWN, file);
+}
+
+/* The child runs on the parent's stack until it calls exec() or
+ * exit(), and those calls overwrite whatever lies below the caller's
+ * stack pointer, including the slot a C function would return through.
+ * So pop the return address into a register, which the kernel hands
+ * back to both parent and child, and push it again after the call. */
+__attribute__ ((naked)) pid_t
+vfork (const char *thread_name UNUSED) {
+	__asm __volatile (
+			"pop %%rsi\n"
+			"mov %0, %%rax\n"
+			"syscall\n"
+			"push %%rsi\n"
+			"ret\n"
+			: : "i" (SYS_VFORK));
+}
+
+int
+ioring_setup (struct io_ring *ring) {
+	return syscall1 (SYS_IORING_SETUP, ring);
+}
+
+int
+ioring_enter (unsigned min_complete) {
+	return syscall1 (SYS_IORING_ENTER, min_complete);
+}
+
 int
 wait (pid_t pid) {
 	return syscall1 (SYS_WAIT, pid);
@@ -110,6 +141,11 @@ open (const char *file) {
 	return syscall1 (SYS_OPEN, file);
 }
 
+int
+open_flags (const char *file, int flags) {
+	return syscall2 (SYS_OPEN_FLAGS, file, flags);
+}
+
 int
 filesize (int fd) {
 	return syscall1 (SYS_FILESIZE, fd);
@@ -155,6 +191,21 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+msync (void *addr, size_t length) {
+	return syscall2 (SYS_MSYNC, addr, length);
+}
+
+int
+faultstat (int who, struct fault_stats *stats) {
+	return syscall2 (SYS_FAULTSTAT, who, stats);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
@@ -0,0 +1,77 @@
+/* Opens a file, writes it, reads it back and closes it through the
+   I/O rings, checking the result and user data of each completion.
+   A read of a bad file descriptor is submitted together with a good
+   one and must complete with -1, and ioring_enter() must wait for
+   both completions when asked to. */
+
+#include <ioring.h>
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static struct io_ring ring;
+static char data[] = "Submitted through the ring and read back.";
+static char buf[sizeof data];
+
+/* Adds a submission to the ring. */
+static void
+queue (int opcode, int fd, void *buffer, unsigned len, uint64_t user_data)
+{
+  struct io_sqe *sqe = &ring.sq[ring.sq_tail % IORING_ENTRIES];
+
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->buf = buffer;
+  sqe->len = len;
+  sqe->offset = 0;
+  sqe->user_data = user_data;
+  ring.sq_tail++;
+}
+
+/* Takes the next completion, which must be for USER_DATA, and
+   returns its result. */
+static int
+reap (uint64_t user_data)
+{
+  struct io_cqe *cqe;
+
+  if (ring.cq_head == ring.cq_tail)
+    fail ("no completion for %d", (int) user_data);
+  cqe = &ring.cq[ring.cq_head++ % IORING_ENTRIES];
+  if (cqe->user_data != user_data)
+    fail ("completion for %d, expected %d",
+          (int) cqe->user_data, (int) user_data);
+  return cqe->res;
+}
+
+void
+test_main (void)
+{
+  int fd;
+
+  CHECK (create ("ioring.dat", sizeof data), "create \"ioring.dat\"");
+  CHECK (ioring_setup (&ring) == 0, "ioring_setup");
+
+  queue (IORING_OP_OPEN, 0, "ioring.dat", 0, 1);
+  CHECK (ioring_enter (1) == 1, "submit open");
+  CHECK ((fd = reap (1)) > 1, "open completed");
+
+  queue (IORING_OP_WRITE, fd, data, sizeof data, 2);
+  CHECK (ioring_enter (1) == 1, "submit write");
+  CHECK (reap (2) == sizeof data, "write completed");
+
+  /* The bad read finishes as it is submitted, ahead of the good one,
+     which ioring_enter() must wait for. */
+  queue (IORING_OP_READ, 99, buf, sizeof buf, 3);
+  queue (IORING_OP_READ, fd, buf, sizeof buf, 4);
+  CHECK (ioring_enter (2) == 2, "submit reads, wait for both");
+  CHECK (reap (3) == -1, "read of bad fd completed with -1");
+  CHECK (reap (4) == sizeof buf, "read completed");
+  CHECK (!memcmp (buf, data, sizeof data), "read back what was written");
+
+  queue (IORING_OP_CLOSE, fd, NULL, 0, 5);
+  CHECK (ioring_enter (1) == 1, "submit close");
+  CHECK (reap (5) == 0, "close completed");
+  CHECK (ring.cq_head == ring.cq_tail, "no completions left");
+}
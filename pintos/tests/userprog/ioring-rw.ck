@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(ioring-rw) begin
+(ioring-rw) create "ioring.dat"
+(ioring-rw) ioring_setup
+(ioring-rw) submit open
+(ioring-rw) open completed
+(ioring-rw) submit write
+(ioring-rw) write completed
+(ioring-rw) submit reads, wait for both
+(ioring-rw) read of bad fd completed with -1
+(ioring-rw) read completed
+(ioring-rw) read back what was written
+(ioring-rw) submit close
+(ioring-rw) close completed
+(ioring-rw) no completions left
+(ioring-rw) end
+ioring-rw: exit(0)
+EOF
+pass;
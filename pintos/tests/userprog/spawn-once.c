@@ -0,0 +1,14 @@
+/* Spawns a single child process from its executable, without
+   forking first, and waits for it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+void
+test_main (void) 
+{
+  pid_t pid = spawn ("child-simple");
+
+  msg ("wait(spawn()) = %d", wait (pid));
+}
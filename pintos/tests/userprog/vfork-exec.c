@@ -0,0 +1,27 @@
+/* vforks a child that execs child-simple.  The parent sleeps until
+   the exec, then waits for the child, and must find its memory
+   intact although the child replaced the address space it was
+   borrowing. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int global = 0x1234;
+
+void
+test_main (void) 
+{
+  int local = 0x5678;
+  pid_t pid = vfork ("child-simple");
+  int status;
+
+  if (pid == 0)
+    {
+      exec ("child-simple");
+      exit (-1);
+    }
+  status = wait (pid);
+  CHECK (local == 0x5678 && global == 0x1234, "parent memory intact");
+  msg ("wait(vfork()) = %d", status);
+}
@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vfork-exec) begin
+(child-simple) run
+child-simple: exit(81)
+(vfork-exec) parent memory intact
+(vfork-exec) wait(vfork()) = 81
+(vfork-exec) end
+vfork-exec: exit(0)
+EOF
+pass;
@@ -0,0 +1,23 @@
+/* vforks a child that exits at once.  The parent must sleep until
+   the child has exited, so the child's exit message comes first, and
+   then find its memory intact: the child ran in it, but must not
+   take it down with it. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+static int global = 0x1234;
+
+void
+test_main (void) 
+{
+  int local = 0x5678;
+  pid_t pid = vfork ("child");
+
+  if (pid == 0)
+    exit (81);
+  CHECK (pid > 0, "vfork");
+  CHECK (local == 0x5678 && global == 0x1234, "parent memory intact");
+  msg ("wait(vfork()) = %d", wait (pid));
+}
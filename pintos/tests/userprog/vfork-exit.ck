@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(vfork-exit) begin
+child: exit(81)
+(vfork-exit) vfork
+(vfork-exit) parent memory intact
+(vfork-exit) wait(vfork()) = 81
+(vfork-exit) end
+vfork-exit: exit(0)
+EOF
+pass;
@@ -0,0 +1,74 @@
+/* Mixes direct and buffered I/O on one file.  A direct write must
+   show up in a buffered read of the same range, even with the old
+   data cached, and a buffered write must show up in a direct read,
+   even before it is written back.  Direct reads and writes that are
+   not sector-aligned must still work, through the buffered path. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define FILE_SIZE (4 * PAGE_SIZE)
+
+static char buf[FILE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+static char check[FILE_SIZE] __attribute__ ((aligned (PAGE_SIZE)));
+
+/* Fills SIZE bytes at P with a pattern that depends on SEED. */
+static void
+fill (char *p, size_t size, int seed)
+{
+  size_t i;
+
+  for (i = 0; i < size; i++)
+    p[i] = (char) (i * 7 + seed);
+}
+
+void
+test_main (void)
+{
+  int direct, buffered;
+
+  CHECK (create ("direct.dat", FILE_SIZE), "create \"direct.dat\"");
+  CHECK ((direct = open_flags ("direct.dat", O_DIRECT)) > 1,
+         "open \"direct.dat\" with O_DIRECT");
+  CHECK ((buffered = open ("direct.dat")) > 1, "open \"direct.dat\"");
+
+  /* Direct write over cached data, then buffered read. */
+  CHECK (read (buffered, check, 2 * PAGE_SIZE) == 2 * PAGE_SIZE,
+         "buffered read of pages 0-1");
+  fill (buf, 2 * PAGE_SIZE, 1);
+  CHECK (write (direct, buf, 2 * PAGE_SIZE) == 2 * PAGE_SIZE,
+         "direct write of pages 0-1");
+  seek (buffered, 0);
+  CHECK (read (buffered, check, 2 * PAGE_SIZE) == 2 * PAGE_SIZE,
+         "buffered read of pages 0-1");
+  if (memcmp (buf, check, 2 * PAGE_SIZE))
+    fail ("buffered read does not see the direct write");
+
+  /* Buffered write, then direct read. */
+  fill (buf, 2 * PAGE_SIZE, 2);
+  CHECK (write (buffered, buf, 2 * PAGE_SIZE) == 2 * PAGE_SIZE,
+         "buffered write of pages 2-3");
+  memset (check, 0, sizeof check);
+  seek (direct, 2 * PAGE_SIZE);
+  CHECK (read (direct, check, 2 * PAGE_SIZE) == 2 * PAGE_SIZE,
+         "direct read of pages 2-3");
+  if (memcmp (buf, check, 2 * PAGE_SIZE))
+    fail ("direct read does not see the buffered write");
+
+  /* Unaligned offset, size and buffer fall back to buffered I/O. */
+  fill (buf, FILE_SIZE, 3);
+  seek (direct, 100);
+  CHECK (write (direct, buf + 1, PAGE_SIZE + 10) == PAGE_SIZE + 10,
+         "unaligned direct write");
+  seek (direct, 100);
+  CHECK (read (direct, check + 1, PAGE_SIZE + 10) == PAGE_SIZE + 10,
+         "unaligned direct read");
+  if (memcmp (buf + 1, check + 1, PAGE_SIZE + 10))
+    fail ("unaligned direct read does not see the unaligned write");
+
+  close (buffered);
+  close (direct);
+}
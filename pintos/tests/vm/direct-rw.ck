@@ -0,0 +1,20 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(direct-rw) begin
+(direct-rw) create "direct.dat"
+(direct-rw) open "direct.dat" with O_DIRECT
+(direct-rw) open "direct.dat"
+(direct-rw) buffered read of pages 0-1
+(direct-rw) direct write of pages 0-1
+(direct-rw) buffered read of pages 0-1
+(direct-rw) buffered write of pages 2-3
+(direct-rw) direct read of pages 2-3
+(direct-rw) unaligned direct write
+(direct-rw) unaligned direct read
+(direct-rw) end
+direct-rw: exit(0)
+EOF
+pass;
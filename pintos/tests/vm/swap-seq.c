@@ -0,0 +1,59 @@
+/* Swaps a large buffer out and back in sequence.
+ * Fills a 24 MB buffer one whole page at a time, then checks it
+ * twice in address order, so that nearly every page is swapped out
+ * and back in while memory is 10 MB.  Pages are evicted and faulted
+ * back in runs, so this checks that clustered swap-out and swap-in
+ * keep every page's data. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SHIFT 12
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define ONE_MB (1 << 20) // 1MB
+#define CHUNK_SIZE (24*ONE_MB)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunks[CHUNK_SIZE];
+
+/* Returns the word stored at index J of page I. */
+static uint32_t
+pattern (size_t i, size_t j)
+{
+  return (uint32_t) (i * 2654435761u) ^ (uint32_t) j;
+}
+
+static void
+check_pass (int pass)
+{
+  size_t i, j;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      uint32_t *page = (uint32_t *) (big_chunks + i * PAGE_SIZE);
+      for (j = 0; j < PAGE_SIZE / sizeof *page; j++)
+        if (page[j] != pattern (i, j))
+          fail ("pass %d: data is inconsistent in page %zu", pass, i);
+    }
+  msg ("pass %d: all %d pages consistent", pass, PAGE_COUNT);
+}
+
+void
+test_main (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      uint32_t *page = (uint32_t *) (big_chunks + i * PAGE_SIZE);
+      for (j = 0; j < PAGE_SIZE / sizeof *page; j++)
+        page[j] = pattern (i, j);
+    }
+  msg ("wrote %d pages", PAGE_COUNT);
+
+  check_pass (1);
+  check_pass (2);
+}
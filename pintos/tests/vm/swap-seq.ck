@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-seq) begin
+(swap-seq) wrote 6144 pages
+(swap-seq) pass 1: all 6144 pages consistent
+(swap-seq) pass 2: all 6144 pages consistent
+(swap-seq) end
+EOF
+pass;
@@ -21,6 +21,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -31,6 +32,7 @@
 #include "tests/threads/tests.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
@@ -86,6 +88,7 @@ int main(void)
 	mem_end = palloc_init();
 	malloc_init();
 	paging_init(mem_end);
+	pcid_init();
 
 #ifdef USERPROG
 	tss_init();
@@ -107,15 +110,19 @@ int main(void)
 	timer_calibrate();
 
 #ifdef FILESYS
-	/* Initialize file system. */
 	disk_init();
-	filesys_init(format_filesys);
 #endif
 
 #ifdef VM
+	/* File data is cached in the page cache, which comes first. */
 	vm_init();
 #endif
 
+#ifdef FILESYS
+	/* Initialize file system. */
+	filesys_init(format_filesys);
+#endif
+
 	printf("Boot complete.\n");
 
 	/* Run actions specified on kernel command line. */
@@ -141,29 +148,95 @@ bss_init(void)
 	memset(&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* CPUID.80000001H:EDX bit reporting 1 GiB page support. */
+#define CPUID_EXT_PDPE1GB (1 << 26)
+
+/* Returns true if the CPU can map 1 GiB pages with PDPE leaves. */
+static bool
+cpu_has_huge_pages(void)
+{
+	uint32_t regs[4];
+
+	cpuid(0x80000000, 0, regs);
+	if (regs[0] < 0x80000001)
+		return false;
+	cpuid(0x80000001, 0, regs);
+	return (regs[3] & CPUID_EXT_PDPE1GB) != 0;
+}
+
+/* Returns the largest page size that can map physical address PA
+ * in the direct map: the page must be aligned, end below MEM_END,
+ * and must not straddle the read-only kernel text
+ * [TEXT_START, TEXT_END). 1 GiB pages are only used if HUGE. */
+static uint64_t
+direct_map_page_size(uint64_t pa, uint64_t mem_end,
+										 uint64_t text_start, uint64_t text_end, bool huge)
+{
+	const uint64_t sizes[] = {HUGE_PGSIZE, LARGE_PGSIZE};
+
+	for (size_t i = 0; i < sizeof sizes / sizeof *sizes; i++)
+	{
+		uint64_t size = sizes[i];
+		if (size == HUGE_PGSIZE && !huge)
+			continue;
+		if (pa % size == 0 && pa + size <= mem_end && (pa + size <= text_start || pa >= text_end))
+			return size;
+	}
+	return PGSIZE;
+}
+
+/* Returns the entry of PML4 that maps a page of SIZE bytes at
+ * VA, allocating the intermediate tables on the way. */
+static uint64_t *
+direct_map_entry(uint64_t *pml4, uint64_t va, uint64_t size)
+{
+	uint64_t *table = pml4;
+
+	for (uint64_t shift = PML4SHIFT;; shift -= 9)
+	{
+		uint64_t *entry = &table[(va >> shift) & 0x1FF];
+		if ((1UL << shift) == size)
+			return entry;
+		if (!(*entry & PTE_P))
+			*entry = vtop(palloc_get_page(PAL_ASSERT | PAL_ZERO)) | PTE_U | PTE_W | PTE_P;
+		table = ptov(PTE_ADDR(*entry));
+	}
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ * The direct map uses the largest pages the CPU supports (1 GiB,
+ * else 2 MiB), falling back to 4 kB pages only around the kernel
+ * text and at unaligned ends of memory, so that kernel accesses
+ * through ptov() need few TLB entries and few page tables.
+ * Kernel mappings are global, so they survive address space
+ * switches once pcid_init() turns on CR4.PGE. */
 static void
 paging_init(uint64_t mem_end)
 {
-	uint64_t *pml4, *pte;
-	int perm;
+	uint64_t *pml4;
+	bool huge = cpu_has_huge_pages();
 	pml4 = base_pml4 = palloc_get_page(PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = vtop(&start);
+	uint64_t text_end = vtop(&_end_kernel_text);
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE)
+	for (uint64_t pa = 0; pa < mem_end;)
 	{
-		uint64_t va = (uint64_t)ptov(pa);
+		uint64_t size = direct_map_page_size(pa, mem_end, text_start, text_end, huge);
+		uint64_t perm = PTE_P | PTE_W | PTE_G;
 
-		perm = PTE_P | PTE_W;
-		if ((uint64_t)&start <= va && va < (uint64_t)&_end_kernel_text)
+		if (size != PGSIZE)
+			perm |= PTE_PS;
+		else if (text_start <= pa && pa < text_end)
 			perm &= ~PTE_W;
 
-		if ((pte = pml4e_walk(pml4, va, 1)) != NULL)
-			*pte = pa | perm;
+		*direct_map_entry(pml4, (uint64_t)ptov(pa), size) = pa | perm;
+		pa += size;
 	}
 
 	// reload cr3
@@ -233,6 +306,26 @@ parse_options(char **argv)
 			user_page_limit = atoi(value);
 		else if (!strcmp(name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp(name, "-fa"))
+		{
+			int pages = atoi(value);
+			vm_fault_around = pages < 1 ? 1
+				: pages > FAULT_AROUND_MAX ? FAULT_AROUND_MAX : pages;
+		}
+		else if (!strcmp(name, "-ksm"))
+		{
+			int pages = atoi(value);
+			vm_ksm_pages = pages < 0 ? 0 : pages;
+		}
+		else if (!strcmp(name, "-fs"))
+			vm_print_faults = true;
+		else if (!strcmp(name, "-zswap"))
+		{
+			int pages = atoi(value);
+			zswap_pool_max = pages < 0 ? 0 : pages;
+		}
 #endif
 		else
 			PANIC("unknown option `%s' (use -h for help)", name);
@@ -342,6 +435,12 @@ usage(void)
 				 "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
 				 "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+				 "  -fa=COUNT          Resolve COUNT pages (1-16) per file page fault.\n"
+				 "  -ksm=COUNT         Merge identical pages, scanning COUNT frames per pass.\n"
+				 "  -zswap=COUNT       Keep swapped pages compressed in up to COUNT pages.\n"
+				 "  -fs                Print page fault statistics of processes at exit.\n"
 #endif
 	);
 	power_off();
@@ -369,6 +468,7 @@ print_stats(void)
 {
 	timer_print_stats();
 	thread_print_stats();
+	palloc_print_stats();
 #ifdef FILESYS
 	disk_print_stats();
 #endif
@@ -377,4 +477,7 @@ print_stats(void)
 #ifdef USERPROG
 	exception_print_stats();
 #endif
+#ifdef VM
+	vm_print_stats();
+#endif
 }
@@ -6,8 +6,159 @@
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
+#include "threads/interrupt.h"
 #include "intrinsic.h"
 
+/* Process-context identifiers (PCIDs).
+
+   With CR4.PCIDE set, the low 12 bits of CR3 tag every TLB entry
+   with the PCID of the address space that created it, and a CR3
+   load with CR3_NOFLUSH set keeps the entries of other PCIDs.
+   Each user pml4 gets a PCID the first time it is activated;
+   PCID 0 belongs to base_pml4.  When the IDs run out they are
+   recycled round-robin, and a recycled ID is flushed before its
+   new owner uses it.
+
+   A pml4's PCID is kept in its otherwise unused last entry, which
+   is never present, so the CPU ignores its remaining bits. */
+#define PCID_CNT 4096                   /* PCIDs available in CR3. */
+#define PCID_SLOT 511                   /* PML4 entry holding the PCID. */
+#define PCID_FLUSH 0x2                  /* Flush PCID on next activation. */
+#define PCID_SHIFT 12                   /* PCID position in the slot. */
+#define CR3_NOFLUSH (1UL << 63)         /* Keep this PCID's TLB entries. */
+#define CR4_PGE (1 << 7)                /* Global pages. */
+#define CR4_PCIDE (1 << 17)             /* Process-context identifiers. */
+#define CPUID_1_ECX_PCID (1 << 17)
+#define CPUID_7_EBX_INVPCID (1 << 10)
+#define INVPCID_ADDR 0                  /* INVPCID: one address. */
+#define INVPCID_CONTEXT 1               /* INVPCID: one PCID. */
+
+static bool pcid_enabled;               /* CR4.PCIDE is set. */
+static bool has_invpcid;                /* INVPCID is available. */
+static uint64_t *pcid_owner[PCID_CNT];  /* PML4 using each PCID. */
+static bool pcid_stale[PCID_CNT];       /* TLB may hold old entries. */
+static unsigned pcid_next = 1;          /* Next PCID to hand out. */
+
+/* Returns the PCID assigned to PML4, or 0 if it has none. */
+static unsigned
+pcid_of (uint64_t *pml4) {
+	unsigned pcid = (pml4[PCID_SLOT] >> PCID_SHIFT) & (PCID_CNT - 1);
+	return pcid != 0 && pcid_owner[pcid] == pml4 ? pcid : 0;
+}
+
+/* Drops every TLB entry tagged with PCID, right away if INVPCID
+ * is available, otherwise at the PCID's next activation. */
+static void
+pcid_flush (unsigned pcid) {
+	if (has_invpcid) {
+		invpcid (INVPCID_CONTEXT, pcid, 0);
+		pcid_stale[pcid] = false;
+	} else
+		pcid_stale[pcid] = true;
+}
+
+/* Assigns a PCID to PML4, taking it away from its previous owner
+ * if every PCID is in use.  Must be called with interrupts off. */
+static unsigned
+pcid_assign (uint64_t *pml4) {
+	unsigned pcid = pcid_next;
+
+	ASSERT (intr_get_level () == INTR_OFF);
+	for (unsigned i = 0; i < PCID_CNT - 1; i++) {
+		unsigned cand = (pcid_next + i - 1) % (PCID_CNT - 1) + 1;
+		if (pcid_owner[cand] == NULL) {
+			pcid = cand;
+			break;
+		}
+	}
+	pcid_next = pcid % (PCID_CNT - 1) + 1;
+
+	if (pcid_owner[pcid] != NULL) {
+		/* Recycle: the old owner picks a new PCID next time. */
+		pcid_owner[pcid][PCID_SLOT] = 0;
+		pcid_flush (pcid);
+	}
+	pcid_owner[pcid] = pml4;
+	pml4[PCID_SLOT] = (uint64_t) pcid << PCID_SHIFT;
+	return pcid;
+}
+
+/* Enables global pages and, if the CPU supports them,
+ * process-context identifiers.  Called once, after paging_init()
+ * has switched to base_pml4. */
+void
+pcid_init (void) {
+	uint32_t regs[4];
+	uint64_t cr4 = rcr4 () | CR4_PGE;
+
+	cpuid (1, 0, regs);
+	if (regs[2] & CPUID_1_ECX_PCID) {
+		cpuid (0, 0, regs);
+		if (regs[0] >= 7) {
+			cpuid (7, 0, regs);
+			has_invpcid = (regs[1] & CPUID_7_EBX_INVPCID) != 0;
+		}
+		/* CR3 holds base_pml4 with PCID 0, as PCIDE requires. */
+		cr4 |= CR4_PCIDE;
+		pcid_enabled = true;
+	}
+	lcr4 (cr4);
+}
+
+/* Returns true if PML4 is the page table the CPU is using. */
+static bool
+is_active (uint64_t *pml4) {
+	return PTE_ADDR (rcr3 ()) == vtop (pml4);
+}
+
+/* Replaces the large page leaf at ENTRY, which maps SIZE bytes,
+ * by a table of 512 entries that map the same memory with the
+ * same permissions using pages of SIZE / 512 bytes.
+ * Returns false if the table could not be allocated. */
+static bool
+split_leaf (uint64_t *entry, uint64_t size) {
+	uint64_t *table = palloc_get_page (0);
+	uint64_t sub_size = size / 512;
+	uint64_t pa = *entry & ~(size - 1);
+	uint64_t flags = *entry & PTE_FLAGS & ~PTE_PS;
+
+	if (table == NULL)
+		return false;
+	if (sub_size != PGSIZE)
+		flags |= PTE_PS;
+	for (unsigned i = 0; i < 512; i++)
+		table[i] = (pa + i * sub_size) | flags;
+	*entry = vtop (table) | PTE_U | PTE_W | PTE_P;
+	return true;
+}
+
+/* Flushes the translation of VA in PML4 from the TLB.  Without
+ * PCIDs only the active page table can have cached entries; with
+ * them, an inactive pml4 may still own entries under its PCID,
+ * which are dropped with INVPCID or at its next activation. */
+static void
+invalidate_page (uint64_t *pml4, const void *va) {
+	enum intr_level old_level;
+	unsigned pcid;
+
+	if (is_active (pml4)) {
+		invlpg ((uint64_t) va);
+		return;
+	}
+	if (!pcid_enabled)
+		return;
+
+	old_level = intr_disable ();
+	pcid = pcid_of (pml4);
+	if (pcid != 0) {
+		if (has_invpcid)
+			invpcid (INVPCID_ADDR, pcid, (uint64_t) va);
+		else
+			pml4[PCID_SLOT] |= PCID_FLUSH;
+	}
+	intr_set_level (old_level);
+}
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -22,6 +173,13 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if ((uint64_t) pte & PTE_PS) {
+			/* 2 MiB leaf.  A lookup gets the leaf itself; a caller
+			 * that wants a 4 kB PTE gets the large page split. */
+			if (!create)
+				return &pdp[idx];
+			if (!split_leaf (&pdp[idx], LARGE_PGSIZE))
+				return NULL;
 		}
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
@@ -45,6 +203,12 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 					return NULL;
 			} else
 				return NULL;
+		} else if ((uint64_t) pde & PTE_PS) {
+			/* 1 GiB leaf, handled like a 2 MiB leaf one level down. */
+			if (!create)
+				return &pdpe[idx];
+			if (!split_leaf (&pdpe[idx], HUGE_PGSIZE))
+				return NULL;
 		}
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
@@ -60,7 +224,11 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
  * If PML4E does not have a page table for VADDR, behavior depends
  * on CREATE.  If CREATE is true, then a new page table is
  * created and a pointer into it is returned.  Otherwise, a null
- * pointer is returned. */
+ * pointer is returned.
+ * If VADDR lies in a large page, a lookup (CREATE false) returns
+ * the PDE or PDPE that maps it, which has PTE_PS set, while
+ * CREATE splits the large page so that a 4 kB PTE can be
+ * returned. */
 uint64_t *
 pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	uint64_t *pte = NULL;
@@ -88,6 +256,60 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the entry mapping VA in PML4, whether it is a PTE or a
+ * large page leaf, and stores the size of the page it maps into
+ * *SIZE.  Returns a null pointer if no table covers VA. */
+static uint64_t *
+leaf_walk (uint64_t *pml4, const uint64_t va, uint64_t *size) {
+	uint64_t *pdpe, *pde;
+
+	*size = PGSIZE;
+	if (pml4 == NULL || !(pml4[PML4 (va)] & PTE_P))
+		return NULL;
+	pdpe = &((uint64_t *) ptov (PTE_ADDR (pml4[PML4 (va)])))[PDPE (va)];
+	if (!(*pdpe & PTE_P))
+		return NULL;
+	if (*pdpe & PTE_PS) {
+		*size = HUGE_PGSIZE;
+		return pdpe;
+	}
+	pde = &((uint64_t *) ptov (PTE_ADDR (*pdpe)))[PDX (va)];
+	if (!(*pde & PTE_P))
+		return NULL;
+	if (*pde & PTE_PS) {
+		*size = LARGE_PGSIZE;
+		return pde;
+	}
+	return &((uint64_t *) ptov (PTE_ADDR (*pde)))[PTX (va)];
+}
+
+/* Returns the PDE for VA in PML4, creating the intermediate
+ * tables if CREATE is true.  A 1 GiB leaf covering VA is split
+ * when creating.  Returns a null pointer if there is no such PDE
+ * or if memory allocation fails. */
+static uint64_t *
+pde_walk (uint64_t *pml4, const uint64_t va, int create) {
+	uint64_t *table = pml4;
+	const uint64_t shifts[] = { PML4SHIFT, PDPESHIFT };
+
+	for (unsigned i = 0; i < sizeof shifts / sizeof *shifts; i++) {
+		uint64_t *entry = &table[(va >> shifts[i]) & 0x1FF];
+		if (!(*entry & PTE_P)) {
+			if (!create)
+				return NULL;
+			uint64_t *new_page = palloc_get_page (PAL_ZERO);
+			if (new_page == NULL)
+				return NULL;
+			*entry = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+		} else if (*entry & PTE_PS) {
+			if (!create || !split_leaf (entry, HUGE_PGSIZE))
+				return NULL;
+		}
+		table = ptov (PTE_ADDR (*entry));
+	}
+	return &table[PDX (va)];
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
  * Returns the new page directory, or a null pointer if memory
@@ -122,10 +344,17 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) pdp_index << PDPESHIFT) |
+									 ((uint64_t) i << PDXSHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
 				return false;
+		}
 	}
 	return true;
 }
@@ -135,15 +364,24 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pde) & PTE_P)
-			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
+		if (((uint64_t) pde) & PTE_P) {
+			if (((uint64_t) pde) & PTE_PS) {
+				void *va = (void *) (((uint64_t) pml4_index << PML4SHIFT) |
+									 ((uint64_t) i << PDPESHIFT));
+				if (!func (&pdp[i], va, aux))
+					return false;
+			} else if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
 				return false;
+		}
 	}
 	return true;
 }
 
-/* Apply FUNC to each available pte entries including kernel's. */
+/* Apply FUNC to each available pte entries including kernel's.
+ * Large pages are visited once, through their PDE or PDPE, with
+ * VA set to the start of the large page; FUNC can tell them apart
+ * with is_large_pte(). */
 bool
 pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
@@ -169,8 +407,12 @@ static void
 pgdir_destroy (uint64_t *pdp) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+		if (((uint64_t) pte) & PTE_P) {
+			if (((uint64_t) pte) & PTE_PS)
+				palloc_free_multiple ((void *) PTE_ADDR (pte), LARGE_PGCNT);
+			else
+				pt_destroy (PTE_ADDR (pte));
+		}
 	}
 	palloc_free_page ((void *) pdp);
 }
@@ -179,7 +421,8 @@ static void
 pdpe_destroy (uint64_t *pdpe) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
-		if (((uint64_t) pde) & PTE_P)
+		/* 1 GiB leaves only ever map kernel memory. */
+		if ((((uint64_t) pde) & PTE_P) && !(((uint64_t) pde) & PTE_PS))
 			pgdir_destroy ((void *) PTE_ADDR (pde));
 	}
 	palloc_free_page ((void *) pdpe);
@@ -191,6 +434,18 @@ pml4_destroy (uint64_t *pml4) {
 	if (pml4 == NULL)
 		return;
 	ASSERT (pml4 != base_pml4);
+	ASSERT (!is_active (pml4));
+
+	/* Give back the PCID; its TLB entries must not outlive us. */
+	if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		unsigned pcid = pcid_of (pml4);
+		if (pcid != 0) {
+			pcid_owner[pcid] = NULL;
+			pcid_flush (pcid);
+		}
+		intr_set_level (old_level);
+	}
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
 	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
@@ -200,10 +455,39 @@ pml4_destroy (uint64_t *pml4) {
 }
 
 /* Loads page directory PD into the CPU's page directory base
- * register. */
+ * register.  With PCIDs the load keeps the TLB entries of every
+ * address space, unless PML4's own entries are known stale. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level;
+	uint64_t cr3;
+	unsigned pcid;
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (!pcid_enabled) {
+		lcr3 (vtop (pml4));
+		return;
+	}
+
+	old_level = intr_disable ();
+	if (pml4 == base_pml4)
+		cr3 = vtop (pml4) | CR3_NOFLUSH;
+	else {
+		pcid = pcid_of (pml4);
+		if (pcid == 0)
+			pcid = pcid_assign (pml4);
+		cr3 = vtop (pml4) | pcid;
+		if (!pcid_stale[pcid] && !(pml4[PCID_SLOT] & PCID_FLUSH))
+			cr3 |= CR3_NOFLUSH;
+		pcid_stale[pcid] = false;
+		pml4[PCID_SLOT] &= ~(uint64_t) PCID_FLUSH;
+	}
+	/* Switching to the address space we are already in is free,
+	 * unless its entries have to be flushed. */
+	if (rcr3 () != (cr3 & ~CR3_NOFLUSH) || !(cr3 & CR3_NOFLUSH))
+		lcr3 (cr3);
+	intr_set_level (old_level);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -214,16 +498,19 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = leaf_walk (pml4, (uint64_t) uaddr, &size);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte) & ~(size - 1))
+			+ ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
 /* Adds a mapping in page map level 4 PML4 from user virtual page
  * UPAGE to the physical frame identified by kernel virtual address KPAGE.
- * UPAGE must not already be mapped. KPAGE should probably be a page obtained
+ * UPAGE must not already be mapped, except as part of a large page,
+ * which is then split. KPAGE should probably be a page obtained
  * from the user pool with palloc_get_page().
  * If WRITABLE is true, the new page is read/write;
  * otherwise it is read-only.
@@ -238,15 +525,19 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		invalidate_page (pml4, upage);
+	}
 	return pte != NULL;
 }
 
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
- * UPAGE need not be mapped. */
+ * UPAGE need not be mapped.  If UPAGE is part of a large page,
+ * the large page is split first; if that fails for lack of
+ * memory, the whole large page is marked not present. */
 void
 pml4_clear_page (uint64_t *pml4, void *upage) {
 	uint64_t *pte;
@@ -256,9 +547,10 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
+		if (is_large_pte (pte) && pml4_split_large_page (pml4, upage))
+			pte = pml4e_walk (pml4, (uint64_t) upage, false);
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		invalidate_page (pml4, upage);
 	}
 }
 
@@ -281,10 +573,9 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
 		if (dirty)
 			*pte |= PTE_D;
 		else
-			*pte &= ~(uint32_t) PTE_D;
+			*pte &= ~(uint64_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		invalidate_page (pml4, vpage);
 	}
 }
 
@@ -307,9 +598,124 @@ pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
-			*pte &= ~(uint32_t) PTE_A;
+			*pte &= ~(uint64_t) PTE_A;
+
+		invalidate_page (pml4, vpage);
+	}
+}
+
+/* Maps the 2 MiB user virtual page UPAGE in PML4 to the 2 MiB
+ * physically contiguous frame at kernel virtual address KPAGE,
+ * e.g. one obtained with palloc_get_large_page().  Both must be
+ * 2 MiB aligned.  If RW is true the page is read/write, otherwise
+ * read-only.  A page table already covering UPAGE is released if
+ * it maps nothing.  Returns false if UPAGE is partly mapped by
+ * 4 kB pages or if memory allocation fails. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT (((uint64_t) upage & LARGE_PGMASK) == 0);
+	ASSERT (((uint64_t) kpage & LARGE_PGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 1);
+	if (pde == NULL)
+		return false;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+	if ((*pde & PTE_P) && !(*pde & PTE_PS)) {
+		uint64_t *pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page (pt);
 	}
+	*pde = vtop (kpage) | PTE_P | PTE_PS | (rw ? PTE_W : 0) | PTE_U;
+	invalidate_page (pml4, upage);
+	return true;
+}
+
+/* Marks the 2 MiB page at user virtual address UPAGE "not
+ * present" in PML4, keeping its other bits.  UPAGE need not be
+ * mapped by a large page. */
+void
+pml4_clear_large_page (uint64_t *pml4, void *upage) {
+	ASSERT (((uint64_t) upage & LARGE_PGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 0);
+	if (pde != NULL && (*pde & PTE_P) && (*pde & PTE_PS)) {
+		*pde &= ~PTE_P;
+		invalidate_page (pml4, upage);
+	}
+}
+
+/* Returns true if UPAGE is mapped by a 2 MiB page in PML4. */
+bool
+pml4_is_large_page (uint64_t *pml4, const void *upage) {
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 0);
+	return pde != NULL && (*pde & PTE_P) && (*pde & PTE_PS);
+}
+
+/* Splits the 2 MiB page containing UPAGE in PML4 into 512 4 kB
+ * pages with the same frames and permissions.  Returns true if
+ * UPAGE is no longer covered by a large page, false if memory
+ * for the new page table could not be allocated. */
+bool
+pml4_split_large_page (uint64_t *pml4, void *upage) {
+	ASSERT (is_user_vaddr (upage));
+
+	uint64_t *pde = pde_walk (pml4, (uint64_t) upage, 0);
+	if (pde == NULL || !(*pde & PTE_P) || !(*pde & PTE_PS))
+		return true;
+	if (!split_leaf (pde, LARGE_PGSIZE))
+		return false;
+	invalidate_page (pml4, upage);
+	return true;
+}
+
+/* Replaces the page table covering the 2 MiB aligned user virtual
+ * address UPAGE in PML4 by a single 2 MiB page, if its 512 PTEs
+ * are all present, map one 2 MiB aligned physically contiguous
+ * run of frames in order, and share the same permissions.  The
+ * accessed and dirty bits of the PTEs are folded into the new
+ * entry.  Returns true if the pages were merged. */
+bool
+pml4_merge_large_page (uint64_t *pml4, void *upage) {
+	const uint64_t perm = PTE_P | PTE_W | PTE_U;
+	uint64_t *pde, *pt;
+	uint64_t pa, ad = 0;
+
+	ASSERT (((uint64_t) upage & LARGE_PGMASK) == 0);
+	ASSERT (is_user_vaddr (upage));
+
+	pde = pde_walk (pml4, (uint64_t) upage, 0);
+	if (pde == NULL || !(*pde & PTE_P) || (*pde & PTE_PS))
+		return false;
+
+	pt = ptov (PTE_ADDR (*pde));
+	pa = PTE_ADDR (pt[0]);
+	if (!(pt[0] & PTE_P) || (pa & LARGE_PGMASK) != 0)
+		return false;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
+		if ((pt[i] & perm) != (pt[0] & perm)
+				|| PTE_ADDR (pt[i]) != pa + i * PGSIZE)
+			return false;
+		ad |= pt[i] & (PTE_A | PTE_D);
+	}
+
+	*pde = pa | (pt[0] & perm) | ad | PTE_PS;
+	palloc_free_page (pt);
+
+	/* Dropping 512 small translations is cheaper by reloading
+	 * CR3, which flushes the active PCID, than by 512 invlpg
+	 * instructions. */
+	if (is_active (pml4))
+		lcr3 (rcr3 ());
+	else if (pcid_enabled) {
+		enum intr_level old_level = intr_disable ();
+		if (pcid_of (pml4) != 0)
+			pml4[PCID_SLOT] |= PCID_FLUSH;
+		intr_set_level (old_level);
+	}
+	return true;
 }
@@ -8,7 +8,9 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
+#include "threads/pte.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
 
@@ -24,12 +26,21 @@
 
    By default, half of system RAM is given to the kernel pool and
    half to the user pool.  That should be huge overkill for the
-   kernel pool, but that's just fine for demonstration purposes. */
+   kernel pool, but that's just fine for demonstration purposes.
+
+   Each pool also tracks which of its free pages are known to be
+   filled with zeros.  The idle thread zeroes freed pages in the
+   background (see palloc_zero_idle()), so that PAL_ZERO requests
+   can usually be served without touching the memory. */
 
 /* A memory pool. */
 struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
+	struct bitmap *zero_map;        /* Free pages known to be zeroed. */
+	size_t dirty_cnt;               /* Free pages not yet zeroed. */
+	size_t free_cnt;                /* Free pages. */
+	size_t zero_cursor;             /* Where the idle zeroer resumes. */
 	uint8_t *base;                  /* Base of pool. */
 };
 
@@ -38,10 +49,17 @@ static struct pool kernel_pool, user_pool;
 
 /* Maximum number of pages to put in user pool. */
 size_t user_page_limit = SIZE_MAX;
+
+/* Statistics. */
+static long long prezeroed_cnt;   /* PAL_ZERO pages served pre-zeroed. */
+static long long sync_zero_cnt;   /* PAL_ZERO pages zeroed on demand. */
+static long long idle_zero_cnt;   /* Pages zeroed by the idle thread. */
+
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static bool zero_one_page (struct pool *);
 
 /* multiboot info */
 struct multiboot_info {
@@ -232,6 +250,14 @@ split:
 			}
 		}
 	}
+
+	// Nothing is known to be zeroed yet, so every free page is dirty.
+	kernel_pool.dirty_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.dirty_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
+	kernel_pool.free_cnt = kernel_pool.dirty_cnt;
+	user_pool.free_cnt = user_pool.dirty_cnt;
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -253,35 +279,111 @@ palloc_init (void) {
 	return ext_mem.end;
 }
 
+/* Accounts for the PAGE_CNT pages at PAGE_IDX in POOL, which the
+   caller just marked used while holding POOL's lock, and returns
+   how many of them were not known to be zeroed. */
+static size_t
+claim_pages (struct pool *pool, size_t page_idx, size_t page_cnt) {
+	enum intr_level old_level = intr_disable ();
+	size_t dirty = page_cnt
+		- bitmap_count (pool->zero_map, page_idx, page_cnt, true);
+	pool->dirty_cnt -= dirty;
+	pool->free_cnt -= page_cnt;
+	intr_set_level (old_level);
+	if (dirty != page_cnt)
+		bitmap_set_multiple (pool->zero_map, page_idx, page_cnt, false);
+	return dirty;
+}
+
+/* Finishes an allocation of PAGE_CNT pages at PAGES according to
+   FLAGS, given that DIRTY of them were not known to be zeroed. */
+static void *
+finish_alloc (void *pages, size_t page_cnt, size_t dirty,
+		enum palloc_flags flags) {
+	if (pages) {
+		if (flags & PAL_ZERO) {
+			if (dirty == 0)
+				prezeroed_cnt += page_cnt;
+			else {
+				memset (pages, 0, PGSIZE * page_cnt);
+				sync_zero_cnt += page_cnt;
+			}
+		}
+	} else {
+		if (flags & PAL_ASSERT)
+			PANIC ("palloc_get: out of pages");
+	}
+
+	return pages;
+}
+
 /* Obtains and returns a group of PAGE_CNT contiguous free pages.
    If PAL_USER is set, the pages are obtained from the user pool,
    otherwise from the kernel pool.  If PAL_ZERO is set in FLAGS,
-   then the pages are filled with zeros.  If too few pages are
+   then the pages are filled with zeros, preferably by handing out
+   pages the idle thread has already zeroed.  If too few pages are
    available, returns a null pointer, unless PAL_ASSERT is set in
    FLAGS, in which case the kernel panics. */
 void *
 palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_idx = BITMAP_ERROR;
+	size_t dirty = 0;
 
 	lock_acquire (&pool->lock);
-	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (flags & PAL_ZERO) {
+		/* Pages in zero_map are free by construction. */
+		page_idx = bitmap_scan_and_flip (pool->zero_map, 0, page_cnt, true);
+		if (page_idx != BITMAP_ERROR) {
+			enum intr_level old_level;
+
+			bitmap_set_multiple (pool->used_map, page_idx, page_cnt, true);
+			old_level = intr_disable ();
+			pool->free_cnt -= page_cnt;
+			intr_set_level (old_level);
+		}
+	}
+	if (page_idx == BITMAP_ERROR) {
+		page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+		if (page_idx != BITMAP_ERROR)
+			dirty = claim_pages (pool, page_idx, page_cnt);
+	}
 	lock_release (&pool->lock);
-	void *pages;
 
-	if (page_idx != BITMAP_ERROR)
-		pages = pool->base + PGSIZE * page_idx;
-	else
-		pages = NULL;
+	return finish_alloc (page_idx != BITMAP_ERROR
+			? pool->base + PGSIZE * page_idx : NULL, page_cnt, dirty, flags);
+}
 
-	if (pages) {
-		if (flags & PAL_ZERO)
-			memset (pages, 0, PGSIZE * page_cnt);
-	} else {
-		if (flags & PAL_ASSERT)
-			PANIC ("palloc_get: out of pages");
-	}
+/* Obtains LARGE_PGCNT contiguous free pages whose physical
+   address is 2 MiB aligned, so that they can back a large page
+   (see pml4_set_large_page()).  FLAGS are interpreted as by
+   palloc_get_multiple().  Free the result with
+   palloc_free_multiple (PAGES, LARGE_PGCNT). */
+void *
+palloc_get_large_page (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = BITMAP_ERROR;
+	size_t dirty = 0;
+	size_t idx;
 
-	return pages;
+	/* The direct map keeps physical and virtual 2 MiB alignment
+	   in step, so aligning the kernel virtual address suffices. */
+	idx = ((uint64_t) pool->base & LARGE_PGMASK) == 0
+		? 0 : (LARGE_PGSIZE - ((uint64_t) pool->base & LARGE_PGMASK)) / PGSIZE;
+
+	lock_acquire (&pool->lock);
+	for (; idx + LARGE_PGCNT <= page_cnt; idx += LARGE_PGCNT)
+		if (bitmap_none (pool->used_map, idx, LARGE_PGCNT)) {
+			bitmap_set_multiple (pool->used_map, idx, LARGE_PGCNT, true);
+			dirty = claim_pages (pool, idx, LARGE_PGCNT);
+			page_idx = idx;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	return finish_alloc (page_idx != BITMAP_ERROR
+			? pool->base + PGSIZE * page_idx : NULL, LARGE_PGCNT, dirty, flags);
 }
 
 /* Obtains a single free page and returns its kernel virtual
@@ -301,6 +403,7 @@ void
 palloc_free_multiple (void *pages, size_t page_cnt) {
 	struct pool *pool;
 	size_t page_idx;
+	enum intr_level old_level;
 
 	ASSERT (pg_ofs (pages) == 0);
 	if (pages == NULL || page_cnt == 0)
@@ -319,7 +422,14 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 	memset (pages, 0xcc, PGSIZE * page_cnt);
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
+
+	/* Dying threads free their pages from the scheduler, so we
+	   cannot take the pool lock here. */
+	old_level = intr_disable ();
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool->dirty_cnt += page_cnt;
+	pool->free_cnt += page_cnt;
+	intr_set_level (old_level);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +438,36 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool if PAL_USER
+   is set in FLAGS, otherwise in the kernel pool.  The count may
+   be stale by the time the caller looks at it. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	return (flags & PAL_USER ? &user_pool : &kernel_pool)->free_cnt;
+}
+
+/* Zeroes one freed page in the background, so that a later
+   PAL_ZERO request can skip the memset.  Called by the idle
+   thread whenever it has nothing else to do; returns true if a
+   page was zeroed, false if there is no work left.
+
+   The idle thread must never sleep, so it cannot acquire the
+   pool locks.  Instead it only touches a pool with interrupts
+   off while nobody holds the pool's lock, which on a
+   uniprocessor excludes every allocator. */
+bool
+palloc_zero_idle (void) {
+	return zero_one_page (&user_pool) || zero_one_page (&kernel_pool);
+}
+
+/* Prints page allocator statistics. */
+void
+palloc_print_stats (void) {
+	printf ("Page allocator: %lld pages pre-zeroed, %lld served zeroed, "
+			"%lld zeroed on demand\n",
+			idle_zero_cnt, prezeroed_cnt, sync_zero_cnt);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -335,16 +475,72 @@ init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
      Calculate the space needed for the bitmap
      and subtract it from the pool's size. */
 	uint64_t pgcnt = (end - start) / PGSIZE;
-	size_t bm_pages = DIV_ROUND_UP (bitmap_buf_size (pgcnt), PGSIZE) * PGSIZE;
+	size_t bm_pages = DIV_ROUND_UP (bitmap_summary_buf_size (pgcnt), PGSIZE)
+		* PGSIZE;
 
 	lock_init(&p->lock);
-	p->used_map = bitmap_create_in_buf (pgcnt, *bm_base, bm_pages);
+	p->used_map = bitmap_create_with_summary_in_buf (pgcnt, *bm_base, bm_pages);
+	p->zero_map = bitmap_create_with_summary_in_buf (pgcnt, *bm_base + bm_pages,
+			bm_pages);
+	p->dirty_cnt = 0;
+	p->free_cnt = 0;
+	p->zero_cursor = 0;
 	p->base = (void *) start;
 
-	// Mark all to unusable.
+	// Mark all to unusable, and none as zeroed.
 	bitmap_set_all(p->used_map, true);
 
-	*bm_base += bm_pages;
+	*bm_base += bm_pages * 2;
+}
+
+/* Maximum number of bits zero_one_page() looks at per call, to
+   bound the time spent with interrupts off. */
+#define ZERO_SCAN_BATCH 512
+
+/* Zeroes one free, not yet zeroed page of POOL.  Returns true if
+   it did so. */
+static bool
+zero_one_page (struct pool *pool) {
+	size_t page_cnt = bitmap_size (pool->used_map);
+	size_t page_idx = BITMAP_ERROR;
+	enum intr_level old_level;
+	size_t i;
+
+	if (pool->dirty_cnt == 0 || page_cnt == 0)
+		return false;
+
+	/* Find a dirty free page and reserve it by marking it used. */
+	old_level = intr_disable ();
+	if (pool->lock.holder == NULL) {
+		for (i = 0; i < ZERO_SCAN_BATCH && i < page_cnt; i++) {
+			size_t idx = (pool->zero_cursor + i) % page_cnt;
+			if (!bitmap_test (pool->used_map, idx)
+					&& !bitmap_test (pool->zero_map, idx)) {
+				page_idx = idx;
+				break;
+			}
+		}
+		pool->zero_cursor = (pool->zero_cursor + i + 1) % page_cnt;
+		if (page_idx != BITMAP_ERROR) {
+			bitmap_mark (pool->used_map, page_idx);
+			pool->dirty_cnt--;
+		}
+	}
+	intr_set_level (old_level);
+
+	if (page_idx == BITMAP_ERROR)
+		return false;
+
+	/* Zero it with interrupts on, then publish it as a zeroed free
+	   page.  Both bits flip together so allocators never see a
+	   zeroed page that is still marked used. */
+	memset (pool->base + PGSIZE * page_idx, 0, PGSIZE);
+	old_level = intr_disable ();
+	bitmap_mark (pool->zero_map, page_idx);
+	bitmap_reset (pool->used_map, page_idx);
+	idle_zero_cnt++;
+	intr_set_level (old_level);
+	return true;
 }
 
 /* Returns true if PAGE was allocated from POOL,
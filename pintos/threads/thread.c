@@ -170,6 +170,11 @@ tid_t thread_create(const char *name, int priority,
 
 	tid = curr->tid = allocate_tid();
 
+#ifdef USERPROG
+	// 만든 스레드가 process_wait()으로 회수할 수 있도록 자식 목록에 추가
+	list_push_back(&thread_current()->children, &curr->child_elem);
+#endif
+
 	// 스레드 실행 컨텍스트 설정
 	curr->tf.rip = (uintptr_t)kernel_thread;
 	curr->tf.R.rdi = (uint64_t)function; // 첫 번째 인자: 실행할 함수 포인터
@@ -355,7 +360,8 @@ int thread_get_priority(void)
 	최초로 스케줄될 때 idle_thread를 초기화하고,
 	전달받은 세마포어를 up하여 thread_start()가 계속 진행될 수 있게 한 뒤 즉시 block된다.
 	이후 idle 스레드는 ready_list에 다시 추가되지 않는다.
-	ready_list가 비어 있을 때 next_thread_to_run()에서 특별히 반환됩니다. */
+	ready_list가 비어 있을 때 next_thread_to_run()에서 특별히 반환됩니다.
+	할 일이 없는 동안에는 palloc_zero_idle()로 해제된 페이지를 한 장씩 0으로 채운다. */
 static void idle(void *idle_started_ UNUSED)
 {
 	struct semaphore *idle_started = idle_started_;
@@ -365,6 +371,10 @@ static void idle(void *idle_started_ UNUSED)
 
 	for (;;)
 	{
+		// 실행할 스레드가 없는 동안 해제된 페이지를 미리 0으로 채워 둔다 (PAL_ZERO 가속)
+		while (list_empty(&ready_list) && palloc_zero_idle())
+			continue;
+
 		// 다른 스레드에게 CPU 양보
 		intr_disable();
 		thread_block();
@@ -402,6 +412,14 @@ static void init_thread(struct thread *t, const char *name, int priority)
 	t->original_priority = priority;
 	list_init(&t->donators);
 	t->waiting_lock = NULL;
+
+#ifdef USERPROG
+	// process_wait() 관련
+	t->exit_status = -1;
+	list_init(&t->children);
+	sema_init(&t->exit_sema, 0);
+	sema_init(&t->reap_sema, 0);
+#endif
 }
 
 /* 다음에 스케줄될 스레드를 선택하여 반환한다.
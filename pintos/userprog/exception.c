@@ -4,6 +4,7 @@
 #include "userprog/gdt.h"
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "userprog/uaccess.h"
 #include "intrinsic.h"
 
 /* Number of page faults processed. */
@@ -146,6 +147,10 @@ page_fault (struct intr_frame *f) {
 		return;
 #endif
 
+	/* A system call passed a bad user address: the access fails. */
+	if (!user && uaccess_fixup (f))
+		return;
+
 	/* Count page faults. */
 	page_fault_cnt++;
 
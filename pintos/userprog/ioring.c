@@ -0,0 +1,398 @@
+/* ioring.c: Batched, asynchronous file I/O through rings in user
+ * memory.
+ *
+ * A process registers a struct io_ring with ioring_setup(), queues
+ * operations in its submission ring, and calls ioring_enter() to
+ * hand all of them to the kernel at once and to collect what has
+ * finished.  Reads and writes go to a pool of kernel workers, so the
+ * process keeps computing while the disk works.
+ *
+ * The workers never touch user memory, which belongs to an address
+ * space they do not run in.  ioring_enter() copies the data of a
+ * write in when submitting it and the data of a read out when
+ * completing it, and it resolves descriptors, so the descriptor
+ * table is only used by its owner.  A read or write works on its own
+ * handle on the file, at an explicit offset, so that closing the
+ * descriptor meanwhile is harmless. */
+
+#include "userprog/ioring.h"
+#include <list.h>
+#include <round.h>
+#include <string.h>
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "userprog/process.h"
+#include "userprog/syscall.h"
+#include "userprog/uaccess.h"
+
+/* Number of worker threads, started by the first ioring_setup(). */
+#define IORING_WORKERS 4
+
+/* Room for the file name of an open. */
+#define IORING_PATH_MAX 128
+
+/* Kernel side of a process's rings. */
+struct ioring {
+	struct io_ring *uring;      /* The rings in user memory. */
+	struct lock lock;           /* Protects the members below. */
+	struct condition done_cond; /* Signaled when DONE grows. */
+	struct list done;           /* Finished requests, not yet reaped. */
+	size_t pending;             /* Requests submitted and not reaped. */
+	size_t running;             /* Requests handed to the workers. */
+};
+
+/* An operation submitted through a ring. */
+struct ioring_req {
+	struct ioring *ring;        /* Ring it was submitted through. */
+	int opcode;                 /* IORING_OP_*. */
+	uint64_t user_data;         /* For the completion. */
+	int res;                    /* Result, once done. */
+	struct file *file;          /* Own handle, or the opened file. */
+	void *buf;                  /* Kernel buffer of a read or write. */
+	size_t page_cnt;            /* Pages in BUF. */
+	void *ubuf;                 /* User buffer of a read. */
+	unsigned len;               /* Bytes to read or write. */
+	off_t ofs;                  /* File offset. */
+	char path[IORING_PATH_MAX]; /* File name of an open. */
+	struct list_elem elem;      /* In WORK_QUEUE or the ring's DONE. */
+};
+
+/* Requests for the workers, protected by WORK_LOCK; WORK_SEMA counts
+ * them. */
+static struct list work_queue;
+static struct lock work_lock;
+static struct semaphore work_sema;
+static bool workers_started;
+
+static void ioring_worker (void *aux);
+
+/* Initializes the work queue.  The workers are started when the
+ * first process sets up a ring. */
+void
+ioring_init (void) {
+	list_init (&work_queue);
+	lock_init (&work_lock);
+	sema_init (&work_sema, 0);
+}
+
+/* Sets up the current process's rings at URING in its memory, which
+ * must stay there while the process runs this executable.  Returns 0
+ * if successful, -1 if the process already has rings or memory ran
+ * out. */
+int
+ioring_setup (struct io_ring *uring) {
+	struct thread *curr = thread_current ();
+	struct ioring *ring;
+	int i;
+
+	if (curr->ioring != NULL)
+		return -1;
+	lock_acquire (&work_lock);
+	if (!workers_started) {
+		for (i = 0; i < IORING_WORKERS; i++)
+			if (thread_create ("iorwq", PRI_DEFAULT, ioring_worker, NULL)
+					== TID_ERROR)
+				break;
+		workers_started = i > 0;
+	}
+	lock_release (&work_lock);
+	if (!workers_started)
+		return -1;
+
+	ring = malloc (sizeof *ring);
+	if (ring == NULL)
+		return -1;
+	ring->uring = uring;
+	lock_init (&ring->lock);
+	cond_init (&ring->done_cond);
+	list_init (&ring->done);
+	ring->pending = ring->running = 0;
+	curr->ioring = ring;
+	return 0;
+}
+
+/* Adds REQ, which is done, to its ring's finished requests. */
+static void
+req_finish (struct ioring_req *req) {
+	struct ioring *ring = req->ring;
+
+	lock_acquire (&ring->lock);
+	list_push_back (&ring->done, &req->elem);
+	cond_signal (&ring->done_cond, &ring->lock);
+	lock_release (&ring->lock);
+}
+
+/* Frees REQ and what it holds. */
+static void
+req_free (struct ioring_req *req) {
+	if (req->file != NULL) {
+		lock_acquire (&filesys_lock);
+		file_close (req->file);
+		lock_release (&filesys_lock);
+	}
+	if (req->buf != NULL)
+		palloc_free_multiple (req->buf, req->page_cnt);
+	free (req);
+}
+
+/* Prepares the request for SQE, copying in what the workers need
+ * from the process, and hands it to the workers, or finishes it at
+ * once if it needs no I/O or is invalid. */
+static void
+submit (struct ioring *ring, const struct io_sqe *sqe) {
+	struct ioring_req *req = calloc (1, sizeof *req);
+	struct file *file;
+
+	if (req == NULL) {
+		/* Cannot even report it; drop the submission. */
+		lock_acquire (&ring->lock);
+		ring->pending--;
+		lock_release (&ring->lock);
+		return;
+	}
+	req->ring = ring;
+	req->opcode = sqe->opcode;
+	req->user_data = sqe->user_data;
+	req->res = -1;
+
+	switch (sqe->opcode) {
+		case IORING_OP_NOP:
+			req->res = 0;
+			break;
+		case IORING_OP_CLOSE:
+			if (process_get_file (sqe->fd) != NULL) {
+				process_close_file (sqe->fd);
+				req->res = 0;
+			}
+			break;
+		case IORING_OP_OPEN: {
+			long len = strncpy_from_user (req->path, sqe->buf,
+					sizeof req->path);
+
+			if (len >= 0 && len < (long) sizeof req->path)
+				goto queue;
+			break;
+		}
+		case IORING_OP_READ:
+		case IORING_OP_WRITE:
+			file = process_get_file (sqe->fd);
+			if (file == NULL || sqe->len > IORING_IO_MAX || sqe->offset < 0)
+				break;
+			req->len = sqe->len;
+			req->ofs = sqe->offset;
+			req->ubuf = sqe->buf;
+			req->page_cnt = DIV_ROUND_UP (sqe->len, PGSIZE);
+			if (req->page_cnt > 0) {
+				req->buf = palloc_get_multiple (0, req->page_cnt);
+				if (req->buf == NULL)
+					break;
+			}
+			if (sqe->opcode == IORING_OP_WRITE
+					&& copy_from_user (req->buf, sqe->buf, sqe->len) != 0)
+				break;
+			lock_acquire (&filesys_lock);
+			req->file = file_reopen (file);
+			lock_release (&filesys_lock);
+			if (req->file != NULL)
+				goto queue;
+			break;
+		default:
+			break;
+	}
+	req_finish (req);
+	return;
+
+queue:
+	lock_acquire (&ring->lock);
+	ring->running++;
+	lock_release (&ring->lock);
+	lock_acquire (&work_lock);
+	list_push_back (&work_queue, &req->elem);
+	lock_release (&work_lock);
+	sema_up (&work_sema);
+}
+
+/* Carries out REQ, an open, read or write.  Only the open takes
+ * FILESYS_LOCK.  A read or write works on the request's own reopened
+ * file at an explicit offset, and the layers below lock for
+ * themselves, so the workers' transfers overlap. */
+static void
+perform (struct ioring_req *req) {
+	switch (req->opcode) {
+		case IORING_OP_OPEN:
+			lock_acquire (&filesys_lock);
+			req->file = filesys_open (req->path);
+			lock_release (&filesys_lock);
+			req->res = req->file != NULL ? 0 : -1;
+			break;
+		case IORING_OP_READ:
+			req->res = file_read_at (req->file, req->buf, req->len, req->ofs);
+			break;
+		case IORING_OP_WRITE:
+			req->res = file_write_at (req->file, req->buf, req->len, req->ofs);
+			break;
+	}
+}
+
+/* A worker: carries out queued requests, one at a time. */
+static void
+ioring_worker (void *aux UNUSED) {
+	for (;;) {
+		struct ioring_req *req;
+		struct ioring *ring;
+
+		sema_down (&work_sema);
+		lock_acquire (&work_lock);
+		req = list_entry (list_pop_front (&work_queue), struct ioring_req,
+				elem);
+		lock_release (&work_lock);
+
+		perform (req);
+		ring = req->ring;
+		lock_acquire (&ring->lock);
+		ring->running--;
+		list_push_back (&ring->done, &req->elem);
+		cond_signal (&ring->done_cond, &ring->lock);
+		lock_release (&ring->lock);
+	}
+}
+
+/* Completes REQ, a finished request taken off its ring, in the
+ * current process: copies out the data of a read and installs the
+ * file of an open.  Returns the completion's result. */
+static int
+complete (struct ioring_req *req) {
+	int res = req->res;
+
+	if (req->opcode == IORING_OP_READ && res > 0
+			&& copy_to_user (req->ubuf, req->buf, res) != 0)
+		res = -1;
+	if (req->opcode == IORING_OP_OPEN && req->file != NULL) {
+		res = process_add_file (req->file);
+		if (res >= 0)
+			req->file = NULL;
+	}
+	return res;
+}
+
+/* Submits the current process's queued submissions, then posts
+ * completions, waiting until MIN_COMPLETE of them have been posted,
+ * or until nothing more can finish or the completion ring is full.
+ * At most IORING_ENTRIES submissions are in flight or unreaped at a
+ * time; the rest wait in the submission ring for a later call.
+ * Stops early at an entry that is not in valid memory, but still
+ * reports the work done before it through the ring heads.  Returns
+ * the number of submissions consumed, or -1 if the process has no
+ * rings or nothing could be done because they are not in valid
+ * memory. */
+int
+ioring_enter (unsigned min_complete) {
+	struct ioring *ring = thread_current ()->ioring;
+	struct io_ring *uring;
+	unsigned sq_head, sq_tail, cq_head, cq_tail, posted = 0;
+	int submitted = 0;
+	bool fault = false;
+
+	if (ring == NULL)
+		return -1;
+	uring = ring->uring;
+	if (copy_from_user (&sq_head, &uring->sq_head, sizeof sq_head) != 0
+			|| copy_from_user (&sq_tail, &uring->sq_tail, sizeof sq_tail) != 0
+			|| copy_from_user (&cq_head, &uring->cq_head, sizeof cq_head) != 0
+			|| copy_from_user (&cq_tail, &uring->cq_tail, sizeof cq_tail) != 0)
+		return -1;
+
+	/* Submit. */
+	while (sq_head != sq_tail) {
+		struct io_sqe sqe;
+
+		lock_acquire (&ring->lock);
+		if (ring->pending >= IORING_ENTRIES) {
+			lock_release (&ring->lock);
+			break;
+		}
+		ring->pending++;
+		lock_release (&ring->lock);
+
+		if (copy_from_user (&sqe, &uring->sq[sq_head % IORING_ENTRIES],
+					sizeof sqe) != 0) {
+			lock_acquire (&ring->lock);
+			ring->pending--;
+			lock_release (&ring->lock);
+			fault = true;
+			break;
+		}
+		submit (ring, &sqe);
+		sq_head++;
+		submitted++;
+	}
+	if (copy_to_user (&uring->sq_head, &sq_head, sizeof sq_head) != 0)
+		fault = true;
+
+	/* Reap. */
+	lock_acquire (&ring->lock);
+	while (!fault && cq_tail - cq_head < IORING_ENTRIES) {
+		struct ioring_req *req;
+		struct io_cqe cqe;
+
+		if (list_empty (&ring->done)) {
+			if (posted >= min_complete || ring->running == 0)
+				break;
+			cond_wait (&ring->done_cond, &ring->lock);
+			continue;
+		}
+		req = list_entry (list_pop_front (&ring->done), struct ioring_req,
+				elem);
+		ring->pending--;
+		lock_release (&ring->lock);
+
+		cqe.user_data = req->user_data;
+		cqe.res = complete (req);
+		if (copy_to_user (&uring->cq[cq_tail % IORING_ENTRIES], &cqe,
+					sizeof cqe) != 0) {
+			/* Keep the completion, now a finished no-op carrying its
+			 * result, for a later call. */
+			lock_acquire (&ring->lock);
+			req->opcode = IORING_OP_NOP;
+			req->res = cqe.res;
+			list_push_front (&ring->done, &req->elem);
+			ring->pending++;
+			fault = true;
+			break;
+		}
+		req_free (req);
+		cq_tail++;
+		posted++;
+		lock_acquire (&ring->lock);
+	}
+	lock_release (&ring->lock);
+	if (copy_to_user (&uring->cq_tail, &cq_tail, sizeof cq_tail) != 0)
+		fault = true;
+	return fault && submitted == 0 && posted == 0 ? -1 : submitted;
+}
+
+/* Tears down the current process's rings, if any, once the workers
+ * are done with its requests.  Finished requests that were never
+ * reaped are dropped. */
+void
+ioring_destroy (void) {
+	struct thread *curr = thread_current ();
+	struct ioring *ring = curr->ioring;
+
+	if (ring == NULL)
+		return;
+	lock_acquire (&ring->lock);
+	while (ring->running > 0)
+		cond_wait (&ring->done_cond, &ring->lock);
+	lock_release (&ring->lock);
+	while (!list_empty (&ring->done))
+		req_free (list_entry (list_pop_front (&ring->done),
+					struct ioring_req, elem));
+	free (ring);
+	curr->ioring = NULL;
+}
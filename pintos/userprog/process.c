@@ -7,13 +7,17 @@
 #include <string.h>
 #include "userprog/gdt.h"
 #include "userprog/tss.h"
+#include "userprog/ioring.h"
+#include "userprog/syscall.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "threads/flags.h"
 #include "threads/init.h"
 #include "threads/interrupt.h"
+#include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "threads/vaddr.h"
@@ -25,7 +29,97 @@
 static void process_cleanup (void);
 static bool load (const char *file_name, struct intr_frame *if_);
 static void initd (void *f_name);
+static void spawnd (void *info_);
 static void __do_fork (void *);
+static void __do_vfork (void *);
+
+/* Number of file descriptors per process.  Descriptors 0 and 1 are
+ * the console and never name files. */
+#define FD_MAX (PGSIZE / sizeof (struct file *))
+
+/* Adds FILE to the current process's open files and returns its
+ * descriptor, or -1 if there is no room. */
+int
+process_add_file (struct file *file) {
+	struct thread *curr = thread_current ();
+	size_t fd;
+
+	if (curr->fd_table == NULL) {
+		curr->fd_table = palloc_get_page (PAL_ZERO);
+		if (curr->fd_table == NULL)
+			return -1;
+	}
+	for (fd = 2; fd < FD_MAX; fd++)
+		if (curr->fd_table[fd] == NULL) {
+			curr->fd_table[fd] = file;
+			return fd;
+		}
+	return -1;
+}
+
+/* Returns the file open as FD in the current process, or a null
+ * pointer if there is none. */
+struct file *
+process_get_file (int fd) {
+	struct thread *curr = thread_current ();
+
+	if (fd < 2 || (size_t) fd >= FD_MAX || curr->fd_table == NULL)
+		return NULL;
+	return curr->fd_table[fd];
+}
+
+/* Closes the file open as FD in the current process, if any. */
+void
+process_close_file (int fd) {
+	struct file *file = process_get_file (fd);
+
+	if (file == NULL)
+		return;
+	thread_current ()->fd_table[fd] = NULL;
+	lock_acquire (&filesys_lock);
+	file_close (file);
+	lock_release (&filesys_lock);
+}
+
+/* Gives the current process its own handles on PARENT's open files.
+ * Returns false if out of memory. */
+static bool
+duplicate_files (struct thread *parent) {
+	struct thread *curr = thread_current ();
+	bool success = true;
+	size_t fd;
+
+	if (parent->fd_table == NULL)
+		return true;
+	curr->fd_table = palloc_get_page (PAL_ZERO);
+	if (curr->fd_table == NULL)
+		return false;
+	lock_acquire (&filesys_lock);
+	for (fd = 2; fd < FD_MAX && success; fd++)
+		if (parent->fd_table[fd] != NULL) {
+			curr->fd_table[fd] = file_duplicate (parent->fd_table[fd]);
+			success = curr->fd_table[fd] != NULL;
+		}
+	lock_release (&filesys_lock);
+	return success;
+}
+
+/* Closes all of the current process's open files. */
+static void
+close_files (void) {
+	struct thread *curr = thread_current ();
+	size_t fd;
+
+	if (curr->fd_table == NULL)
+		return;
+	lock_acquire (&filesys_lock);
+	for (fd = 2; fd < FD_MAX; fd++)
+		if (curr->fd_table[fd] != NULL)
+			file_close (curr->fd_table[fd]);
+	lock_release (&filesys_lock);
+	palloc_free_page (curr->fd_table);
+	curr->fd_table = NULL;
+}
 
 /* General process initializer for initd and other process. */
 static void
@@ -57,6 +151,74 @@ process_create_initd (const char *file_name) {
 	return tid;
 }
 
+/* Sets up IF_ for entering user mode, before load() fills in the
+ * entry point and stack. */
+static void
+user_if_init (struct intr_frame *if_) {
+	if_->ds = if_->es = if_->ss = SEL_UDSEG;
+	if_->cs = SEL_UCSEG;
+	if_->eflags = FLAG_IF | FLAG_MBS;
+}
+
+/* Handed from process_spawn() to spawnd() in the child. */
+struct spawn_info {
+	char *file_name;                /* Page holding the executable's name. */
+	struct semaphore loaded;        /* Up'd once the child has loaded. */
+	bool success;                   /* Whether it did. */
+};
+
+/* Starts a new process running the executable FILE_NAME.  Unlike
+ * fork() followed by exec(), the child is built straight from the
+ * executable, so the cost does not depend on the size of the
+ * current process.  Returns the new process's thread id, or
+ * TID_ERROR if the thread cannot be created or the executable cannot
+ * be loaded.  Does not return until the child has loaded. */
+tid_t
+process_spawn (const char *file_name) {
+	struct spawn_info info;
+	tid_t tid;
+
+	info.file_name = palloc_get_page (0);
+	if (info.file_name == NULL)
+		return TID_ERROR;
+	strlcpy (info.file_name, file_name, PGSIZE);
+	sema_init (&info.loaded, 0);
+	info.success = false;
+
+	tid = thread_create (file_name, PRI_DEFAULT, spawnd, &info);
+	if (tid == TID_ERROR) {
+		palloc_free_page (info.file_name);
+		return TID_ERROR;
+	}
+	sema_down (&info.loaded);
+	return info.success ? tid : TID_ERROR;
+}
+
+/* A thread function that loads the process process_spawn() starts.
+ * INFO_ lives on the parent's stack and is gone once the parent
+ * wakes up. */
+static void
+spawnd (void *info_) {
+	struct spawn_info *info = info_;
+	struct intr_frame _if;
+	bool success;
+
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
+	process_init ();
+
+	user_if_init (&_if);
+	success = load (info->file_name, &_if);
+	palloc_free_page (info->file_name);
+	info->success = success;
+	sema_up (&info->loaded);
+	if (!success)
+		thread_exit ();
+	do_iret (&_if);
+	NOT_REACHED ();
+}
+
 /* A thread function that launches first user process. */
 static void
 initd (void *f_name) {
@@ -71,13 +233,95 @@ initd (void *f_name) {
 	NOT_REACHED ();
 }
 
+/* Handed from process_fork() to __do_fork() in the child. */
+struct fork_info {
+	struct thread *parent;
+	struct intr_frame *parent_if;   /* Parent's user context at fork(). */
+	struct semaphore done;          /* Up'd once the child is set up. */
+	bool success;                   /* Whether it was. */
+};
+
 /* Clones the current process as `name`. Returns the new process's thread id, or
- * TID_ERROR if the thread cannot be created. */
+ * TID_ERROR if the thread cannot be created.
+ * Does not return until the child has duplicated the parent's
+ * resources. */
 tid_t
-process_fork (const char *name, struct intr_frame *if_ UNUSED) {
+process_fork (const char *name, struct intr_frame *if_) {
+	struct fork_info info;
+	tid_t tid;
+
+	info.parent = thread_current ();
+	info.parent_if = if_;
+	sema_init (&info.done, 0);
+	info.success = false;
+
 	/* Clone current thread to new thread.*/
-	return thread_create (name,
-			PRI_DEFAULT, __do_fork, thread_current ());
+	tid = thread_create (name, PRI_DEFAULT, __do_fork, &info);
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+	sema_down (&info.done);
+	return info.success ? tid : TID_ERROR;
+}
+
+/* Clones the current process as `name`, like process_fork(), except
+ * that the child runs in the current process's address space instead
+ * of a copy of it until it calls exec or exits, and the current
+ * process sleeps until then.  The child runs on the parent's user
+ * stack, so it must do nothing else, and the user-side vfork() keeps
+ * its return address in a register rather than on that stack.  Returns
+ * the child's thread id, or TID_ERROR if the thread cannot be created. */
+tid_t
+process_vfork (const char *name, struct intr_frame *if_) {
+	struct fork_info info;
+	tid_t tid;
+
+	info.parent = thread_current ();
+	info.parent_if = if_;
+	sema_init (&info.done, 0);
+	info.success = false;
+
+	tid = thread_create (name, PRI_DEFAULT, __do_vfork, &info);
+	if (tid == TID_ERROR)
+		return TID_ERROR;
+	sema_down (&info.done);
+	return info.success ? tid : TID_ERROR;
+}
+
+/* A thread function that enters the child of process_vfork(), which
+ * borrows the parent's page table and, through vm_owner(), its
+ * supplemental page table.  INFO stays valid while the parent
+ * sleeps. */
+static void
+__do_vfork (void *aux) {
+	struct fork_info *info = aux;
+	struct thread *current = thread_current ();
+	struct intr_frame if_;
+
+	memcpy (&if_, info->parent_if, sizeof (struct intr_frame));
+	if_.R.rax = 0;
+
+	if (!duplicate_files (info->parent)) {
+		sema_up (&info->done);
+		thread_exit ();
+	}
+	current->pml4 = info->parent->pml4;
+	current->vfork_parent = info->parent;
+	current->vfork_done = &info->done;
+	info->success = true;
+	process_activate (current);
+	process_init ();
+	do_iret (&if_);
+}
+
+/* Gives the address space that CURR borrowed through process_vfork()
+ * back to its parent and wakes the parent up. */
+static void
+vfork_release (struct thread *curr) {
+	curr->pml4 = NULL;
+	pml4_activate (NULL);
+	curr->vfork_parent = NULL;
+	sema_up (curr->vfork_done);
+	curr->vfork_done = NULL;
 }
 
 #ifndef VM
@@ -119,14 +363,16 @@ duplicate_pte (uint64_t *pte, void *va, void *aux) {
 static void
 __do_fork (void *aux) {
 	struct intr_frame if_;
-	struct thread *parent = (struct thread *) aux;
+	struct fork_info *info = aux;
+	struct thread *parent = info->parent;
 	struct thread *current = thread_current ();
-	/* TODO: somehow pass the parent_if. (i.e. process_fork()'s if_) */
-	struct intr_frame *parent_if;
+	struct intr_frame *parent_if = info->parent_if;
 	bool succ = true;
 
-	/* 1. Read the cpu context to local stack. */
+	/* 1. Read the cpu context to local stack.  The child sees fork()
+	 * return 0. */
 	memcpy (&if_, parent_if, sizeof (struct intr_frame));
+	if_.R.rax = 0;
 
 	/* 2. Duplicate PT */
 	current->pml4 = pml4_create();
@@ -149,12 +395,28 @@ __do_fork (void *aux) {
 	 * TODO:       from the fork() until this function successfully duplicates
 	 * TODO:       the resources of parent.*/
 
+	if (!duplicate_files (parent))
+		goto error;
+
+	/* The child loads the pages of the executable it has not touched
+	 * yet from its own handle on it. */
+	if (parent->exec_file != NULL) {
+		current->exec_file = file_duplicate (parent->exec_file);
+		if (current->exec_file == NULL)
+			goto error;
+	}
+
 	process_init ();
 
-	/* Finally, switch to the newly created process. */
-	if (succ)
+	/* Finally, switch to the newly created process.  INFO lives on
+	 * the parent's stack and is gone once the parent wakes up. */
+	if (succ) {
+		info->success = true;
+		sema_up (&info->done);
 		do_iret (&if_);
+	}
 error:
+	sema_up (&info->done);
 	thread_exit ();
 }
 
@@ -169,12 +431,13 @@ process_exec (void *f_name) {
 	 * This is because when current thread rescheduled,
 	 * it stores the execution information to the member. */
 	struct intr_frame _if;
-	_if.ds = _if.es = _if.ss = SEL_UDSEG;
-	_if.cs = SEL_UCSEG;
-	_if.eflags = FLAG_IF | FLAG_MBS;
+	user_if_init (&_if);
 
 	/* We first kill the current context */
 	process_cleanup ();
+#ifdef VM
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
 	/* And then load the binary */
 	success = load (file_name, &_if);
@@ -197,16 +460,47 @@ process_exec (void *f_name) {
  * been successfully called for the given TID, returns -1
  * immediately, without waiting.
  *
- * This function will be implemented in problem 2-2.  For now, it
- * does nothing. */
+ * A child that exits stays around, blocked in process_exit(), until
+ * it is waited for or its parent exits, so its status is still there
+ * to collect. */
 int
-process_wait (tid_t child_tid UNUSED) {
-	/* XXX: Hint) The pintos exit if process_wait (initd), we recommend you
-	 * XXX:       to add infinite loop here before
-	 * XXX:       implementing the process_wait. */
+process_wait (tid_t child_tid) {
+	struct thread *curr = thread_current ();
+	struct list_elem *e;
+
+	for (e = list_begin (&curr->children); e != list_end (&curr->children);
+			e = list_next (e)) {
+		struct thread *child = list_entry (e, struct thread, child_elem);
+		int status;
+
+		if (child->tid != child_tid)
+			continue;
+		list_remove (e);
+		sema_down (&child->exit_sema);
+		status = child->exit_status;
+		sema_up (&child->reap_sema);
+		return status;
+	}
 	return -1;
 }
 
+/* Lets go of the current thread's children, which will not be waited
+ * for any more, and then waits for the current thread's creator to
+ * collect its exit status, or to exit itself. */
+static void
+process_reap (void) {
+	struct thread *curr = thread_current ();
+
+	while (!list_empty (&curr->children)) {
+		struct thread *child = list_entry (list_pop_front (&curr->children),
+				struct thread, child_elem);
+
+		sema_up (&child->reap_sema);
+	}
+	sema_up (&curr->exit_sema);
+	sema_down (&curr->reap_sema);
+}
+
 /* Exit the process. This function is called by thread_exit (). */
 void
 process_exit (void) {
@@ -216,7 +510,15 @@ process_exit (void) {
 	 * TODO: project2/process_termination.html).
 	 * TODO: We recommend you to implement process resource cleanup here. */
 
+#ifdef VM
+	if (vm_print_faults && curr->pml4 != NULL)
+		vm_print_fault_stats (curr->name, curr->fault_stats);
+	free (curr->fault_stats);
+	curr->fault_stats = NULL;
+#endif
+	close_files ();
 	process_cleanup ();
+	process_reap ();
 }
 
 /* Free the current process's resources. */
@@ -224,10 +526,24 @@ static void
 process_cleanup (void) {
 	struct thread *curr = thread_current ();
 
+	/* The rings are in the address space going away. */
+	ioring_destroy ();
+
+	/* A borrowed address space is only handed back. */
+	if (curr->vfork_parent != NULL) {
+		vfork_release (curr);
+		return;
+	}
+
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
 #endif
 
+	/* The executable stays open while its pages may still be loaded
+	 * lazily. */
+	file_close (curr->exec_file);
+	curr->exec_file = NULL;
+
 	uint64_t *pml4;
 	/* Destroy the current process's page directory and switch back
 	 * to the kernel-only page directory. */
@@ -420,8 +736,14 @@ load (const char *file_name, struct intr_frame *if_) {
 	success = true;
 
 done:
-	/* We arrive here whether the load is successful or not. */
-	file_close (file);
+	/* We arrive here whether the load is successful or not.
+	 * On success the file is closed by process_cleanup(), and cannot
+	 * be written meanwhile, since its pages may be shared. */
+	if (success) {
+		file_deny_write (file);
+		t->exec_file = file;
+	} else
+		file_close (file);
 	return success;
 }
 
@@ -574,11 +896,52 @@ install_page (void *upage, void *kpage, bool writable) {
  * If you want to implement the function for only project 2, implement it on the
  * upper block. */
 
+/* Where a lazily loaded page of the executable comes from. */
+struct segment_aux {
+	off_t ofs;                  /* Offset in the executable. */
+	size_t read_bytes;          /* Bytes to read; the rest is zero. */
+};
+
+/* Reads the contents of PAGE from its owner's executable, as
+ * described by AUX, which is freed. */
+static bool
+lazy_load_segment (struct page *page, void *aux_) {
+	struct segment_aux *aux = aux_;
+	struct file *file = page->owner->exec_file;
+	uint8_t *kva = page->frame->kva;
+	bool success;
+
+	success = file_read_at (file, kva, aux->read_bytes, aux->ofs)
+		== (int) aux->read_bytes;
+	memset (kva + aux->read_bytes, 0, PGSIZE - aux->read_bytes);
+	free (aux);
+	return success;
+}
+
+/* Creates the pending page at VA of VMA, a segment of the
+ * executable, in the current process. */
 static bool
-lazy_load_segment (struct page *page, void *aux) {
-	/* TODO: Load the segment from the file */
-	/* TODO: This called when the first page fault occurs on address VA. */
-	/* TODO: VA is available when calling this function. */
+segment_alloc_page (struct vma *vma, void *va) {
+	size_t delta = (uint8_t *) va - vma->start;
+	size_t read_bytes = vma->read_bytes > delta ? vma->read_bytes - delta : 0;
+	struct segment_aux *aux;
+
+	/* Pages with nothing to read need no aux data, which lets fork
+	 * hand them to the child without loading them. */
+	if (read_bytes == 0)
+		return vm_alloc_page (VM_ANON, va, vma->writable);
+
+	aux = malloc (sizeof *aux);
+	if (aux == NULL)
+		return false;
+	aux->ofs = vma->ofs + delta;
+	aux->read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
+	if (!vm_alloc_page_with_initializer (VM_ANON, va, vma->writable,
+				lazy_load_segment, aux)) {
+		free (aux);
+		return false;
+	}
+	return true;
 }
 
 /* Loads a segment starting at offset OFS in FILE at address
@@ -602,38 +965,57 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
+	/* Read-only pages that hold nothing but file data, whole pages of
+	 * it or the end of the file, map the page cache directly, so that
+	 * every process running the executable shares one clean copy. */
+	if (!writable) {
+		size_t share_bytes = ofs + (off_t) read_bytes == file_length (file)
+			? read_bytes : ROUND_DOWN (read_bytes, PGSIZE);
+		size_t share_size = ROUND_UP (share_bytes, PGSIZE);
+
+		if (share_bytes > 0) {
+			if (do_mmap (upage, share_bytes, false, file, ofs) == NULL)
+				return false;
+			read_bytes -= share_bytes;
+			zero_bytes -= share_size - share_bytes;
+			upage += share_size;
+			ofs += share_bytes;
+		}
+	}
 
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		void *aux = NULL;
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage,
-					writable, lazy_load_segment, aux))
-			return false;
+	/* The rest becomes one area, whose pages are created as they are
+	 * touched. */
+	if (read_bytes > 0 || zero_bytes > 0) {
+		struct vma *vma = vma_create (&thread_current ()->spt, upage,
+				upage + read_bytes + zero_bytes, writable);
 
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
+		if (vma == NULL)
+			return false;
+		vma->alloc_page = segment_alloc_page;
+		vma->ofs = ofs;
+		vma->read_bytes = read_bytes;
 	}
 	return true;
 }
 
-/* Create a PAGE of stack at the USER_STACK. Return true on success. */
+/* Create a PAGE of stack at the USER_STACK. Return true on success.
+ * The stack area covers STACK_MAX bytes below USER_STACK; the pages
+ * below the first are added as the stack grows into them. */
 static bool
 setup_stack (struct intr_frame *if_) {
 	bool success = false;
 	void *stack_bottom = (void *) (((uint8_t *) USER_STACK) - PGSIZE);
+	struct vma *vma = vma_create (&thread_current ()->spt,
+			(uint8_t *) USER_STACK - STACK_MAX, (void *) USER_STACK, true);
 
-	/* TODO: Map the stack on stack_bottom and claim the page immediately.
-	 * TODO: If success, set the rsp accordingly.
-	 * TODO: You should mark the page is stack. */
-	/* TODO: Your code goes here */
-
+	if (vma == NULL)
+		return false;
+	vma->stack = true;
+	if (vm_alloc_page (VM_ANON, stack_bottom, true)
+			&& vm_claim_page (stack_bottom)) {
+		if_->rsp = USER_STACK;
+		success = true;
+	}
 	return success;
 }
 #endif /* VM */
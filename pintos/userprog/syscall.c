@@ -1,4 +1,5 @@
 #include "userprog/syscall.h"
+#include <fcntl.h>
 #include <stdio.h>
 #include <syscall-nr.h>
 #include "threads/interrupt.h"
@@ -7,10 +8,27 @@
 #include "userprog/gdt.h"
 #include "threads/flags.h"
 #include "intrinsic.h"
+#include "devices/input.h"
+#include "filesys/file.h"
+#include "filesys/filesys.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "userprog/ioring.h"
+#include "userprog/process.h"
+#include "userprog/uaccess.h"
+#ifdef VM
+#include "devices/disk.h"
+#include "threads/mmu.h"
+#include "vm/vm.h"
+#endif
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
 
+/* Serializes calls into the file system. */
+struct lock filesys_lock;
+
 /* System call.
  *
  * Previously system call services was handled by the interrupt handler
@@ -35,12 +53,460 @@ syscall_init (void) {
 	 * mode stack. Therefore, we masked the FLAG_FL. */
 	write_msr(MSR_SYSCALL_MASK,
 			FLAG_IF | FLAG_TF | FLAG_DF | FLAG_IOPL | FLAG_AC | FLAG_NT);
+
+	lock_init (&filesys_lock);
+	ioring_init ();
+}
+
+/* Room for a file name or path passed to a system call. */
+#define PATH_BUF 128
+
+/* Largest read() or write() that goes through a buffer on the
+ * kernel stack; larger ones go through a page a piece at a time, or,
+ * on a file with VM, pin RW_CHUNK_PAGES user pages at a time. */
+#define IO_SMALL 256
+#define RW_CHUNK_PAGES 16
+
+/* Terminates the current process with STATUS. */
+static void NO_RETURN
+exit_process (int status) {
+	printf ("%s: exit(%d)\n", thread_name (), status);
+	thread_current ()->exit_status = status;
+	thread_exit ();
+}
+
+/* Copies the string at USTR in user memory into BUF, which has room
+ * for SIZE bytes.  Returns false if the string does not fit.  Exits
+ * the process if USTR is not a valid string in user memory. */
+static bool
+get_user_string (char *buf, const char *ustr, size_t size) {
+	long len = strncpy_from_user (buf, ustr, size);
+
+	if (len < 0)
+		exit_process (-1);
+	return (size_t) len < size;
+}
+
+#ifdef VM
+/* Does read(), or write() if WRITE, of SIZE bytes at UBUF on FILE,
+ * which was opened with O_DIRECT, with the disk moving the data
+ * straight into or out of the user pages, pinned a piece at a time.
+ * Only transfers of at least a page whose buffer, size and file
+ * position are all multiples of DISK_SECTOR_SIZE, and that lie
+ * within the file, qualify.  Returns the number of bytes moved, or
+ * -1 if the transfer does not qualify.  Exits the process if UBUF is
+ * not valid user memory. */
+static int
+direct_rw (struct file *file, void *ubuf, unsigned size, bool write) {
+	size_t chunk_max = PGSIZE / sizeof (void *);
+	off_t ofs = file_tell (file);
+	unsigned done = 0;
+	void **buffers;
+
+	if (size < PGSIZE || size % DISK_SECTOR_SIZE != 0
+			|| ofs % DISK_SECTOR_SIZE != 0
+			|| (uintptr_t) ubuf % DISK_SECTOR_SIZE != 0
+			|| ofs > file_length (file)
+			|| size > (unsigned) (file_length (file) - ofs))
+		return -1;
+	buffers = palloc_get_page (0);
+	if (buffers == NULL)
+		return -1;
+
+	while (done < size) {
+		uint8_t *uaddr = (uint8_t *) ubuf + done;
+		size_t cnt = (size - done) / DISK_SECTOR_SIZE, i;
+		off_t n;
+
+		if (cnt > chunk_max)
+			cnt = chunk_max;
+		/* A read writes the user pages. */
+		if (!vm_pin_range (uaddr, cnt * DISK_SECTOR_SIZE, !write)) {
+			palloc_free_page (buffers);
+			exit_process (-1);
+		}
+		for (i = 0; i < cnt; i++)
+			buffers[i] = pml4_get_page (thread_current ()->pml4,
+					uaddr + i * DISK_SECTOR_SIZE);
+		lock_acquire (&filesys_lock);
+		n = file_direct_io (file, buffers, cnt, write);
+		lock_release (&filesys_lock);
+		vm_unpin_range (uaddr, cnt * DISK_SECTOR_SIZE);
+		done += n;
+		if (n == 0)
+			break;
+	}
+	palloc_free_page (buffers);
+	return done;
+}
+
+/* Does read(), or write() if WRITE, of SIZE bytes at UBUF on FILE
+ * without a bounce buffer: the user pages are pinned RW_CHUNK_PAGES
+ * at a time, so that they stay resident, and the file system copies
+ * straight between the page cache and the kernel's mapping of their
+ * frames.  Returns the number of bytes moved.  Exits the process if
+ * UBUF is not valid user memory. */
+static int
+pinned_rw (struct file *file, void *ubuf, unsigned size, bool write) {
+	unsigned done = 0;
+
+	while (done < size) {
+		uint8_t *uaddr = (uint8_t *) ubuf + done;
+		size_t chunk = RW_CHUNK_PAGES * PGSIZE - pg_ofs (uaddr);
+		size_t pos = 0;
+		bool eof = false;
+
+		if (chunk > size - done)
+			chunk = size - done;
+		/* A read writes the user pages. */
+		if (!vm_pin_range (uaddr, chunk, !write))
+			exit_process (-1);
+		while (pos < chunk && !eof) {
+			void *kva = pml4_get_page (thread_current ()->pml4, uaddr + pos);
+			size_t n = PGSIZE - pg_ofs (uaddr + pos);
+			off_t moved;
+
+			if (n > chunk - pos)
+				n = chunk - pos;
+			lock_acquire (&filesys_lock);
+			moved = write ? file_write (file, kva, n) : file_read (file, kva, n);
+			lock_release (&filesys_lock);
+			pos += moved;
+			eof = (size_t) moved < n;
+		}
+		vm_unpin_range (uaddr, chunk);
+		done += pos;
+		if (eof)
+			break;
+	}
+	return done;
+}
+#endif
+
+/* Does read(), or write() if WRITE, of SIZE bytes at UBUF on FD.
+ * With VM, a file transfer of more than IO_SMALL bytes works on the
+ * pinned user pages; anything else goes through a kernel buffer, so
+ * that the file system never touches user memory that may fault.
+ * Returns the number of bytes moved, or -1 if FD is not open for it.
+ * Exits the process if UBUF is not valid user memory. */
+static int
+do_rw (int fd, void *ubuf, unsigned size, bool write) {
+	uint8_t small[IO_SMALL];
+	uint8_t *buf = small;
+	size_t buf_size = sizeof small;
+	struct file *file = NULL;
+	unsigned done = 0;
+
+	if (fd == (write ? STDIN_FILENO : STDOUT_FILENO))
+		return -1;
+	if (fd != STDIN_FILENO && fd != STDOUT_FILENO) {
+		file = process_get_file (fd);
+		if (file == NULL)
+			return -1;
+	}
+#ifdef VM
+	if (file != NULL && file_is_direct (file)) {
+		int n = direct_rw (file, ubuf, size, write);
+
+		if (n >= 0)
+			return n;
+	}
+	if (file != NULL && size > IO_SMALL)
+		return pinned_rw (file, ubuf, size, write);
+#endif
+	if (size > sizeof small) {
+		buf = palloc_get_page (0);
+		if (buf == NULL)
+			return -1;
+		buf_size = PGSIZE;
+	}
+
+	while (done < size) {
+		uint8_t *uaddr = (uint8_t *) ubuf + done;
+		size_t chunk = size - done < buf_size ? size - done : buf_size;
+		off_t n = chunk;
+		size_t i;
+
+		if (write) {
+			if (copy_from_user (buf, uaddr, chunk) != 0)
+				goto fault;
+			if (file == NULL)
+				putbuf ((const char *) buf, chunk);
+			else {
+				lock_acquire (&filesys_lock);
+				n = file_write (file, buf, chunk);
+				lock_release (&filesys_lock);
+			}
+		} else {
+			if (file == NULL)
+				for (i = 0; i < chunk; i++)
+					buf[i] = input_getc ();
+			else {
+				lock_acquire (&filesys_lock);
+				n = file_read (file, buf, chunk);
+				lock_release (&filesys_lock);
+			}
+			if (copy_to_user (uaddr, buf, n) != 0)
+				goto fault;
+		}
+		done += n;
+		if ((size_t) n < chunk)
+			break;
+	}
+	if (buf != small)
+		palloc_free_page (buf);
+	return done;
+
+fault:
+	if (buf != small)
+		palloc_free_page (buf);
+	exit_process (-1);
+}
+
+/* System call handlers.  Each takes its arguments from the
+ * registers in F and leaves its result in F->R.rax. */
+typedef void syscall_func (struct intr_frame *f);
+
+static void
+sys_halt (struct intr_frame *f UNUSED) {
+	power_off ();
+}
+
+static void
+sys_exit (struct intr_frame *f) {
+	exit_process (f->R.rdi);
+}
+
+static void
+sys_fork (struct intr_frame *f) {
+	char name[PATH_BUF];
+
+	f->R.rax = get_user_string (name, (const char *) f->R.rdi, sizeof name)
+		? process_fork (name, f) : TID_ERROR;
+}
+
+static void
+sys_exec (struct intr_frame *f) {
+	char *file_name = palloc_get_page (0);
+
+	if (file_name == NULL)
+		exit_process (-1);
+	if (!get_user_string (file_name, (const char *) f->R.rdi, PGSIZE)) {
+		palloc_free_page (file_name);
+		exit_process (-1);
+	}
+	/* process_exec() frees FILE_NAME and only returns on failure,
+	 * with the old address space already gone. */
+	process_exec (file_name);
+	exit_process (-1);
+}
+
+static void
+sys_wait (struct intr_frame *f) {
+	f->R.rax = process_wait (f->R.rdi);
+}
+
+static void
+sys_create (struct intr_frame *f) {
+	char name[PATH_BUF];
+
+	if (!get_user_string (name, (const char *) f->R.rdi, sizeof name)) {
+		f->R.rax = false;
+		return;
+	}
+	lock_acquire (&filesys_lock);
+	f->R.rax = filesys_create (name, f->R.rsi);
+	lock_release (&filesys_lock);
+}
+
+static void
+sys_remove (struct intr_frame *f) {
+	char name[PATH_BUF];
+
+	if (!get_user_string (name, (const char *) f->R.rdi, sizeof name)) {
+		f->R.rax = false;
+		return;
+	}
+	lock_acquire (&filesys_lock);
+	f->R.rax = filesys_remove (name);
+	lock_release (&filesys_lock);
 }
 
+/* Opens the file named by the string at UNAME in user memory, with
+ * FLAGS, a combination of O_* flags, and returns its new file
+ * descriptor, or -1 on failure. */
+static int
+do_open (const char *uname, int flags) {
+	char name[PATH_BUF];
+	struct file *file;
+	int fd;
+
+	if ((flags & ~O_DIRECT) != 0
+			|| !get_user_string (name, uname, sizeof name))
+		return -1;
+	lock_acquire (&filesys_lock);
+	file = filesys_open (name);
+	lock_release (&filesys_lock);
+	if (file == NULL)
+		return -1;
+	file_set_direct (file, (flags & O_DIRECT) != 0);
+	fd = process_add_file (file);
+	if (fd < 0) {
+		lock_acquire (&filesys_lock);
+		file_close (file);
+		lock_release (&filesys_lock);
+	}
+	return fd;
+}
+
+static void
+sys_open (struct intr_frame *f) {
+	f->R.rax = do_open ((const char *) f->R.rdi, 0);
+}
+
+static void
+sys_open_flags (struct intr_frame *f) {
+	f->R.rax = do_open ((const char *) f->R.rdi, f->R.rsi);
+}
+
+static void
+sys_filesize (struct intr_frame *f) {
+	struct file *file = process_get_file (f->R.rdi);
+
+	f->R.rax = file != NULL ? file_length (file) : -1;
+}
+
+static void
+sys_read (struct intr_frame *f) {
+	f->R.rax = do_rw (f->R.rdi, (void *) f->R.rsi, f->R.rdx, false);
+}
+
+static void
+sys_write (struct intr_frame *f) {
+	f->R.rax = do_rw (f->R.rdi, (void *) f->R.rsi, f->R.rdx, true);
+}
+
+static void
+sys_seek (struct intr_frame *f) {
+	struct file *file = process_get_file (f->R.rdi);
+
+	if (file != NULL)
+		file_seek (file, f->R.rsi);
+}
+
+static void
+sys_tell (struct intr_frame *f) {
+	struct file *file = process_get_file (f->R.rdi);
+
+	f->R.rax = file != NULL ? file_tell (file) : 0;
+}
+
+static void
+sys_close (struct intr_frame *f) {
+	process_close_file (f->R.rdi);
+}
+
+#ifdef VM
+static void
+sys_mmap (struct intr_frame *f) {
+	struct file *file = process_get_file (f->R.r8);
+
+	f->R.rax = 0;
+	if (file == NULL || file_length (file) == 0)
+		return;
+	lock_acquire (&filesys_lock);
+	f->R.rax = (uint64_t) do_mmap ((void *) f->R.rdi, f->R.rsi, f->R.rdx,
+			file, f->R.r10);
+	lock_release (&filesys_lock);
+}
+
+static void
+sys_munmap (struct intr_frame *f) {
+	do_munmap ((void *) f->R.rdi);
+}
+
+static void
+sys_madvise (struct intr_frame *f) {
+	f->R.rax = vm_madvise ((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+}
+
+static void
+sys_msync (struct intr_frame *f) {
+	f->R.rax = do_msync ((void *) f->R.rdi, f->R.rsi);
+}
+
+static void
+sys_faultstat (struct intr_frame *f) {
+	f->R.rax = vm_faultstat (f->R.rdi, (void *) f->R.rsi);
+}
+#endif
+
+static void
+sys_spawn (struct intr_frame *f) {
+	char name[PATH_BUF];
+
+	f->R.rax = get_user_string (name, (const char *) f->R.rdi, sizeof name)
+		? process_spawn (name) : TID_ERROR;
+}
+
+static void
+sys_vfork (struct intr_frame *f) {
+	char name[PATH_BUF];
+
+	f->R.rax = get_user_string (name, (const char *) f->R.rdi, sizeof name)
+		? process_vfork (name, f) : TID_ERROR;
+}
+
+static void
+sys_ioring_setup (struct intr_frame *f) {
+	f->R.rax = ioring_setup ((struct io_ring *) f->R.rdi);
+}
+
+static void
+sys_ioring_enter (struct intr_frame *f) {
+	f->R.rax = ioring_enter (f->R.rdi);
+}
+
+/* System call handlers, indexed by system call number.  Calls
+ * without one terminate the process. */
+static syscall_func *const syscall_table[] = {
+	[SYS_HALT] = sys_halt,
+	[SYS_EXIT] = sys_exit,
+	[SYS_FORK] = sys_fork,
+	[SYS_EXEC] = sys_exec,
+	[SYS_WAIT] = sys_wait,
+	[SYS_CREATE] = sys_create,
+	[SYS_REMOVE] = sys_remove,
+	[SYS_OPEN] = sys_open,
+	[SYS_FILESIZE] = sys_filesize,
+	[SYS_READ] = sys_read,
+	[SYS_WRITE] = sys_write,
+	[SYS_SEEK] = sys_seek,
+	[SYS_TELL] = sys_tell,
+	[SYS_CLOSE] = sys_close,
+#ifdef VM
+	[SYS_MMAP] = sys_mmap,
+	[SYS_MUNMAP] = sys_munmap,
+	[SYS_MADVISE] = sys_madvise,
+	[SYS_MSYNC] = sys_msync,
+	[SYS_FAULTSTAT] = sys_faultstat,
+#endif
+	[SYS_SPAWN] = sys_spawn,
+	[SYS_VFORK] = sys_vfork,
+	[SYS_IORING_SETUP] = sys_ioring_setup,
+	[SYS_IORING_ENTER] = sys_ioring_enter,
+	[SYS_OPEN_FLAGS] = sys_open_flags,
+};
+
 /* The main system call interface */
 void
-syscall_handler (struct intr_frame *f UNUSED) {
-	// TODO: Your implementation goes here.
-	printf ("system call!\n");
-	thread_exit ();
+syscall_handler (struct intr_frame *f) {
+	uint64_t nr = f->R.rax;
+
+	/* Lets kernel faults on the user stack grow it. */
+	thread_current ()->user_rsp = f->rsp;
+	if (nr >= sizeof syscall_table / sizeof *syscall_table
+			|| syscall_table[nr] == NULL)
+		exit_process (-1);
+	syscall_table[nr] (f);
 }
@@ -0,0 +1,109 @@
+/* uaccess.c: Access to user memory from system calls.
+ *
+ * The kernel reads and writes user memory directly instead of
+ * checking first, page by page, that it is mapped.  Only the bounds
+ * of a range are checked up front, to keep kernel addresses out.
+ * Each instruction that touches user memory is listed in the
+ * exception table, the __ex_table section, with the place to resume
+ * at if it faults.  When page_fault() gets a fault by the kernel
+ * that the VM cannot resolve, uaccess_fixup() finds the faulting
+ * instruction there and resumes at its fixup, so that the access
+ * fails instead of the kernel. */
+
+#include "userprog/uaccess.h"
+#include <stdint.h>
+#include "threads/vaddr.h"
+
+/* An entry of the exception table: an instruction that may fault on
+ * a bad user address, and where to resume if it does. */
+struct exception_entry {
+	uintptr_t insn;
+	uintptr_t fixup;
+};
+
+/* Bounds of the exception table, from the linker script. */
+extern const struct exception_entry __start_ex_table[];
+extern const struct exception_entry __stop_ex_table[];
+
+/* Assembler for an exception table entry that sends faults at label
+ * INSN to label FIXUP. */
+#define EXTABLE(INSN, FIXUP)                    \
+	".pushsection __ex_table, \"a\"\n"          \
+	".balign 8\n"                               \
+	".quad " #INSN ", " #FIXUP "\n"             \
+	".popsection\n"
+
+/* Returns true if the SIZE bytes at UADDR lie below KERN_BASE. */
+static inline bool
+user_range_ok (const void *uaddr, size_t size) {
+	return (uintptr_t) uaddr <= KERN_BASE
+		&& size <= KERN_BASE - (uintptr_t) uaddr;
+}
+
+/* Copies SIZE bytes from USRC in user memory to DST.  Returns the
+ * number of bytes that could not be copied, 0 if all were. */
+size_t
+copy_from_user (void *dst, const void *usrc, size_t size) {
+	if (!user_range_ok (usrc, size))
+		return size;
+	/* A fault leaves RCX counting the bytes not yet copied. */
+	__asm __volatile ("1: rep movsb\n"
+			"2:\n"
+			EXTABLE (1b, 2b)
+			: "+c" (size), "+D" (dst), "+S" (usrc) : : "memory");
+	return size;
+}
+
+/* Copies SIZE bytes from SRC to UDST in user memory.  Returns the
+ * number of bytes that could not be copied, 0 if all were. */
+size_t
+copy_to_user (void *udst, const void *src, size_t size) {
+	if (!user_range_ok (udst, size))
+		return size;
+	__asm __volatile ("1: rep movsb\n"
+			"2:\n"
+			EXTABLE (1b, 2b)
+			: "+c" (size), "+D" (udst), "+S" (src) : : "memory");
+	return size;
+}
+
+/* Copies the string at USRC in user memory, null terminator
+ * included, to DST, which has room for SIZE bytes.  Returns the
+ * length of the string, SIZE if it does not fit, or -1 if it runs
+ * into a bad address first. */
+long
+strncpy_from_user (char *dst, const char *usrc, size_t size) {
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		int c;
+
+		if (!is_user_vaddr (usrc + i))
+			return -1;
+		__asm __volatile ("movl $-1, %0\n"
+				"1: movzbl %1, %0\n"
+				"2:\n"
+				EXTABLE (1b, 2b)
+				: "=&r" (c) : "m" (usrc[i]));
+		if (c < 0)
+			return -1;
+		dst[i] = c;
+		if (c == '\0')
+			return i;
+	}
+	return size;
+}
+
+/* If F faulted at an instruction in the exception table, makes it
+ * resume at the instruction's fixup and returns true. */
+bool
+uaccess_fixup (struct intr_frame *f) {
+	const struct exception_entry *e;
+
+	for (e = __start_ex_table; e < __stop_ex_table; e++)
+		if (e->insn == f->rip) {
+			f->rip = e->fixup;
+			return true;
+		}
+	return false;
+}
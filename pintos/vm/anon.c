@@ -1,6 +1,14 @@
 /* anon.c: Implementation of page for non-disk image (a.k.a. anonymous page). */
 
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+#include "vm/zswap.h"
 #include "devices/disk.h"
 
 /* DO NOT MODIFY BELOW LINE */
@@ -9,6 +17,39 @@ static bool anon_swap_in (struct page *page, void *kva);
 static bool anon_swap_out (struct page *page);
 static void anon_destroy (struct page *page);
 
+/* The swap disk is divided into page-sized slots. */
+#define SECTORS_PER_SLOT (PGSIZE / DISK_SECTOR_SIZE)
+
+static struct bitmap *swap_slots;   /* In-use swap slots. */
+static uint16_t *slot_refs;         /* # of pages referring to each slot. */
+static size_t swap_cursor;          /* Where the next slot search starts. */
+static struct lock swap_lock;       /* Protects these and the readahead state. */
+
+/* Swap readahead.  A swap-in fault also reads the pages next to the
+ * faulting one whose contents sit in the adjacent slots, where
+ * clustered swap-out put them, up to RA_WINDOW pages in all.  A page
+ * read ahead counts as a hit once the clock finds it used, and as a
+ * miss if it leaves memory unused.  Every SWAP_RA_SAMPLE outcomes
+ * the window doubles if most were hits and halves if most were
+ * misses.  At a window of one page, every SWAP_RA_PROBE-th swap-in
+ * reads ahead anyway, to notice when accesses turn sequential
+ * again. */
+#define SWAP_RA_SAMPLE 32
+#define SWAP_RA_PROBE 16
+static size_t ra_window = SWAP_RA_MAX / 2;
+static size_t ra_hits;              /* Hits since the window changed. */
+static size_t ra_outcomes;          /* Outcomes since the window changed. */
+static size_t ra_probe;             /* Swap-ins at a window of one. */
+
+/* Swap statistics. */
+static long long swap_out_cnt;      /* # of pages written to swap. */
+static long long swap_write_cnt;    /* # of batches they were written in. */
+static long long swap_in_cnt;       /* # of pages read from swap. */
+static long long zswap_in_cnt;      /* # of pages loaded from zswap. */
+static long long swap_read_cnt;     /* # of reads the pages came in with. */
+static long long ra_page_cnt;       /* # of pages read ahead. */
+static long long ra_hit_cnt;        /* # of those that got used. */
+
 /* DO NOT MODIFY this struct */
 static const struct page_operations anon_ops = {
 	.swap_in = anon_swap_in,
@@ -20,8 +61,63 @@ static const struct page_operations anon_ops = {
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	zswap_init ();
+	swap_cursor = 0;
+	if (swap_disk != NULL) {
+		size_t slot_cnt = disk_size (swap_disk) / SECTORS_PER_SLOT;
+		swap_slots = bitmap_create_with_summary (slot_cnt);
+		slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+		if (swap_slots == NULL || slot_refs == NULL)
+			PANIC ("swap slot bitmap creation failed");
+	}
+}
+
+/* Prints swap statistics. */
+void
+vm_anon_print_stats (void) {
+	printf ("Swap: %lld pages out in %lld writes, %lld pages in "
+			"in %lld reads\n", swap_out_cnt, swap_write_cnt, swap_in_cnt,
+			swap_read_cnt);
+	printf ("Swap readahead: %lld pages read ahead, %lld used, "
+			"window %zu\n", ra_page_cnt, ra_hit_cnt, ra_window);
+	zswap_print_stats ();
+	printf ("zswap: %lld of %lld swap-ins hit\n", zswap_in_cnt,
+			zswap_in_cnt + swap_in_cnt);
+}
+
+/* Allocates CNT contiguous swap slots and returns the first, or
+ * SWAP_NONE if there is no such run.  The search continues from
+ * the end of the previous allocation, so consecutive clusters land
+ * next to each other on the disk. */
+static size_t
+slot_alloc (size_t cnt) {
+	size_t slot;
+
+	if (swap_slots == NULL)
+		return SWAP_NONE;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_slots, swap_cursor, cnt, false);
+	if (slot == BITMAP_ERROR)
+		slot = bitmap_scan_and_flip (swap_slots, 0, cnt, false);
+	if (slot != BITMAP_ERROR)
+		swap_cursor = (slot + cnt) % bitmap_size (swap_slots);
+	lock_release (&swap_lock);
+	return slot != BITMAP_ERROR ? slot : SWAP_NONE;
+}
+
+/* Drops a page's reference to swap slot SLOT, freeing the slot
+ * with the last one. */
+static void
+slot_free (size_t slot) {
+	lock_acquire (&swap_lock);
+	ASSERT (bitmap_test (swap_slots, slot));
+	ASSERT (slot_refs[slot] > 0);
+	if (--slot_refs[slot] == 0)
+		bitmap_reset (swap_slots, slot);
+	lock_release (&swap_lock);
 }
 
 /* Initialize the file mapping */
@@ -31,22 +127,210 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_NONE;
+	anon_page->zswap = NULL;
+	anon_page->ra = false;
+	memset (kva, 0, PGSIZE);
+	return true;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Swap in the page by read contents from the swap disk.
+ * A page kept in zswap is decompressed straight into KVA; otherwise
+ * the page's sectors are read with a single disk command. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	void *sectors[SECTORS_PER_SLOT];
+	size_t i;
+
+	if (anon_page->zswap != NULL) {
+		zswap_load (anon_page->zswap, kva);
+		zswap_put (anon_page->zswap);
+		anon_page->zswap = NULL;
+		zswap_in_cnt++;
+		return true;
+	}
+	if (anon_page->slot == SWAP_NONE)
+		return false;
+
+	for (i = 0; i < SECTORS_PER_SLOT; i++)
+		sectors[i] = (uint8_t *) kva + i * DISK_SECTOR_SIZE;
+	disk_read_multiple (swap_disk, anon_page->slot * SECTORS_PER_SLOT,
+			sectors, SECTORS_PER_SLOT);
+
+	slot_free (anon_page->slot);
+	anon_page->slot = SWAP_NONE;
+	swap_in_cnt++;
+	swap_read_cnt++;
+	return true;
+}
+
+/* Returns how many pages a swap-in fault should read, the faulting
+ * one included. */
+size_t
+anon_swap_ra_window (void) {
+	size_t window;
+
+	lock_acquire (&swap_lock);
+	window = ra_window;
+	if (window == 1 && ++ra_probe % SWAP_RA_PROBE == 0)
+		window = 2;
+	lock_release (&swap_lock);
+	return window;
+}
+
+/* Reads the CNT anonymous PAGES, whose contents sit in consecutive
+ * swap slots in the same order, into the pinned frames the caller
+ * gave them, with a single disk command, and frees the slots.  Every
+ * page but PAGE, the one faulted on, is marked as read ahead. */
+void
+anon_swap_in_cluster (struct page **pages, size_t cnt, struct page *page) {
+	void *sectors[SWAP_RA_MAX * SECTORS_PER_SLOT];
+	size_t first = pages[0]->anon.slot, i, j;
+
+	ASSERT (cnt >= 1 && cnt <= SWAP_RA_MAX);
+
+	for (i = 0; i < cnt; i++) {
+		ASSERT (pages[i]->anon.slot == first + i);
+		ASSERT (pages[i]->frame != NULL);
+		for (j = 0; j < SECTORS_PER_SLOT; j++)
+			sectors[i * SECTORS_PER_SLOT + j] =
+				(uint8_t *) pages[i]->frame->kva + j * DISK_SECTOR_SIZE;
+	}
+	disk_read_multiple (swap_disk, first * SECTORS_PER_SLOT, sectors,
+			cnt * SECTORS_PER_SLOT);
+
+	for (i = 0; i < cnt; i++) {
+		slot_free (first + i);
+		pages[i]->anon.slot = SWAP_NONE;
+		pages[i]->anon.ra = pages[i] != page;
+	}
+	swap_in_cnt += cnt;
+	swap_read_cnt++;
+	ra_page_cnt += cnt - 1;
+}
+
+/* Records the outcome of a page read ahead, USED or not, and adapts
+ * the window.  Must be called with SWAP_LOCK held. */
+static void
+ra_account (bool used) {
+	if (used) {
+		ra_hits++;
+		ra_hit_cnt++;
+	}
+	if (++ra_outcomes < SWAP_RA_SAMPLE)
+		return;
+	if (ra_hits * 4 >= ra_outcomes * 3 && ra_window < SWAP_RA_MAX)
+		ra_window *= 2;
+	else if (ra_hits * 2 < ra_outcomes && ra_window > 1)
+		ra_window /= 2;
+	ra_hits = ra_outcomes = 0;
+}
+
+/* Called when PAGE, if it was read ahead, turns out to be USED, or
+ * leaves memory without having been. */
+void
+anon_ra_used (struct page *page, bool used) {
+	if (!page->anon.ra)
+		return;
+	page->anon.ra = false;
+	lock_acquire (&swap_lock);
+	ra_account (used);
+	lock_release (&swap_lock);
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1);
+}
+
+/* Swaps out the CNT resident anonymous PAGES, which must be
+ * unmapped already.  Pages that compress well are kept in zswap;
+ * the others go to contiguous swap slots with a single batch of
+ * disk writes.  Every page sharing one of the frames after fork
+ * refers to the same copy.  Returns false, storing nothing, if
+ * there is no run of free slots for the pages zswap turned away. */
+bool
+anon_swap_out_cluster (struct page **pages, size_t cnt) {
+	const void *sectors[SWAP_CLUSTER * SECTORS_PER_SLOT];
+	struct zswap_entry *entries[SWAP_CLUSTER];
+	size_t disk_cnt = 0, first = SWAP_NONE, i, j, n;
+
+	ASSERT (cnt >= 1 && cnt <= SWAP_CLUSTER);
+
+	for (i = 0; i < cnt; i++) {
+		ASSERT (pages[i]->frame != NULL);
+		entries[i] = zswap_store (pages[i]->frame->kva);
+		if (entries[i] == NULL) {
+			for (j = 0; j < SECTORS_PER_SLOT; j++)
+				sectors[disk_cnt * SECTORS_PER_SLOT + j] =
+					(uint8_t *) pages[i]->frame->kva + j * DISK_SECTOR_SIZE;
+			disk_cnt++;
+		}
+	}
+
+	if (disk_cnt > 0) {
+		first = slot_alloc (disk_cnt);
+		if (first == SWAP_NONE) {
+			for (i = 0; i < cnt; i++)
+				if (entries[i] != NULL)
+					zswap_put (entries[i]);
+			return false;
+		}
+		disk_write_multiple (swap_disk, first * SECTORS_PER_SLOT, sectors,
+				disk_cnt * SECTORS_PER_SLOT);
+		swap_out_cnt += disk_cnt;
+		swap_write_cnt++;
+	}
+
+	lock_acquire (&swap_lock);
+	for (i = n = 0; i < cnt; i++) {
+		struct list *sharers = &pages[i]->frame->pages;
+		struct list_elem *e;
+
+		for (e = list_begin (sharers); e != list_end (sharers);
+				e = list_next (e)) {
+			struct page *page = list_entry (e, struct page, frame_elem);
+
+			if (page->anon.ra) {
+				page->anon.ra = false;
+				ra_account (false);
+			}
+			if (entries[i] != NULL) {
+				zswap_get (entries[i]);
+				page->anon.zswap = entries[i];
+			} else {
+				page->anon.slot = first + n;
+				slot_refs[first + n]++;
+			}
+		}
+		if (entries[i] != NULL)
+			zswap_put (entries[i]);
+		else
+			n++;
+	}
+	lock_release (&swap_lock);
+	return true;
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
 	struct anon_page *anon_page = &page->anon;
+
+	anon_ra_used (page, page->frame != NULL && page->owner->pml4 != NULL
+			&& pml4_is_accessed (page->owner->pml4, page->va));
+
+	/* Waits for an eviction of the page in progress, which may
+	 * still assign it a slot. */
+	vm_free_frame (page);
+	if (anon_page->slot != SWAP_NONE) {
+		slot_free (anon_page->slot);
+		anon_page->slot = SWAP_NONE;
+	}
+	if (anon_page->zswap != NULL) {
+		zswap_put (anon_page->zswap);
+		anon_page->zswap = NULL;
+	}
 }
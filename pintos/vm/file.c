@@ -1,6 +1,10 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
+#include <round.h>
 #include "vm/vm.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -14,45 +18,258 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Protects the reference counts of mappings, which fork shares
+ * between processes. */
+static struct lock mmap_lock;
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
+	lock_init (&mmap_lock);
 }
 
 /* Initialize the file backed page */
 bool
-file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
+file_backed_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &file_ops;
+	return true;
+}
+
+/* Initializer of pending mapped pages: records the part of the file
+ * PAGE maps, from AUX, a struct file_page, which it frees. */
+static bool
+lazy_map_file (struct page *page, void *aux) {
+	page->file = *(struct file_page *) aux;
+	free (aux);
+	return true;
+}
+
+/* Returns the part of the file that PAGE, which may still be
+ * pending, maps. */
+static struct file_page *
+page_file (struct page *page) {
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return page->uninit.aux;
+	return &page->file;
+}
+
+/* Maps PAGE onto the page cache frame holding its part of the file,
+ * initializing it first if it is pending.  If IO, the page is read
+ * into the cache if necessary; otherwise PAGE is only mapped if its
+ * data is already resident.  Returns true if PAGE was mapped. */
+bool
+file_backed_claim (struct page *page, bool io) {
+	struct file_page *file_page = page_file (page);
+	struct inode *inode = file_get_inode (file_page->map->file);
+	struct page *cached;
+	bool success;
 
-	struct file_page *file_page = &page->file;
+	cached = io ? page_cache_get (inode, file_page->ofs, page->advice)
+		: page_cache_find (inode, file_page->ofs);
+	if (cached == NULL)
+		return false;
+	success = (VM_TYPE (page->operations->type) != VM_UNINIT
+			|| swap_in (page, NULL))
+		&& vm_share_frame (page, cached);
+	page_cache_put (cached);
+	return success;
+}
+
+/* Starts reading the part of the file that VMA, a file mapping,
+ * maps at [START, END) into the page cache, without waiting for it,
+ * so that later faults in the range find it resident. */
+void
+file_backed_prefetch (struct vma *vma, void *start, void *end) {
+	page_cache_prefetch (file_get_inode (vma->map->file),
+			vma->ofs + ((uint8_t *) start - vma->start),
+			((uint8_t *) end - (uint8_t *) start) / PGSIZE);
+}
+
+/* Writes back the pages that VMA, a file mapping, maps at
+ * [START, END) and that were written through any mapping since they
+ * were last cleaned.  Clean pages cost no I/O, and consecutive dirty
+ * ones are written together. */
+void
+file_backed_sync (struct vma *vma, void *start, void *end) {
+	page_cache_flush_range (file_get_inode (vma->map->file),
+			vma->ofs + ((uint8_t *) start - vma->start),
+			(uint8_t *) end - (uint8_t *) start);
 }
 
 /* Swap in the page by read contents from the file. */
+/* File-backed pages never get frames of their own: they share page
+ * cache frames through file_backed_claim(). */
 static bool
-file_backed_swap_in (struct page *page, void *kva) {
-	struct file_page *file_page UNUSED = &page->file;
+file_backed_swap_in (struct page *page UNUSED, void *kva UNUSED) {
+	return false;
 }
 
 /* Swap out the page by writeback contents to the file. */
+/* Never called: a page cache frame is evicted through its cache
+ * page, which writes it back. */
 static bool
-file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+file_backed_swap_out (struct page *page UNUSED) {
+	return false;
 }
 
-/* Destory the file backed page. PAGE will be freed by the caller. */
+/* Destory the file backed page. PAGE will be freed by the caller.
+ * Anything written through it stays in the page cache, which writes
+ * it back to the file. */
 static void
 file_backed_destroy (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	vm_free_frame (page);
+	mmap_file_put (page->file.map);
+}
+
+/* Adds a reference to MAP. */
+void
+mmap_file_get (struct mmap_file *map) {
+	lock_acquire (&mmap_lock);
+	map->ref_cnt++;
+	lock_release (&mmap_lock);
+}
+
+/* Drops a reference to MAP, closing the file and freeing MAP when
+ * it was the last one. */
+void
+mmap_file_put (struct mmap_file *map) {
+	bool last;
+
+	lock_acquire (&mmap_lock);
+	last = --map->ref_cnt == 0;
+	lock_release (&mmap_lock);
+	if (last) {
+		file_close (map->file);
+		free (map);
+	}
+}
+
+/* Creates the pending page at VA of VMA, a file mapping, in the
+ * current process. */
+static bool
+map_alloc_page (struct vma *vma, void *va) {
+	struct file_page *aux = malloc (sizeof *aux);
+
+	if (aux == NULL)
+		return false;
+	aux->map = vma->map;
+	aux->ofs = vma->ofs + ((uint8_t *) va - vma->start);
+	if (!vm_alloc_page_with_initializer (VM_FILE, va, vma->writable,
+				lazy_map_file, aux)) {
+		free (aux);
+		return false;
+	}
+	mmap_file_get (vma->map);
+	return true;
 }
 
 /* Do the mmap */
+/* Maps LENGTH bytes of FILE, starting at OFFSET, at ADDR.  ADDR and
+ * OFFSET must be page-aligned and the range must not overlap any
+ * other area.  The mapping is a single area whose pages are created
+ * and brought in on demand by mapping the page cache, so that they
+ * share memory with read() and write() on the same file, or all at
+ * once before returning if MAP_POPULATE is or'd into WRITABLE.
+ * Bytes past the end of the file read as zeros and are not written
+ * back.  Returns ADDR, or a null pointer on failure. */
 void *
 do_mmap (void *addr, size_t length, int writable,
 		struct file *file, off_t offset) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct mmap_file *map;
+	struct vma *vma;
+	bool populate = (writable & MAP_POPULATE) != 0;
+	size_t page_cnt, i;
+
+	writable &= ~MAP_POPULATE;
+	if (addr == NULL || pg_ofs (addr) != 0 || offset % PGSIZE != 0
+			|| length == 0 || file == NULL)
+		return NULL;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if (!is_user_vaddr (addr)
+			|| page_cnt > ((uint64_t) KERN_BASE - (uint64_t) addr) / PGSIZE)
+		return NULL;
+
+	map = malloc (sizeof *map);
+	if (map == NULL)
+		return NULL;
+	map->file = file_reopen (file);
+	if (map->file == NULL) {
+		free (map);
+		return NULL;
+	}
+	map->addr = addr;
+	map->ref_cnt = 1;
+
+	/* The area takes over the reference to MAP. */
+	vma = vma_create (spt, addr, (uint8_t *) addr + page_cnt * PGSIZE,
+			writable);
+	if (vma == NULL) {
+		mmap_file_put (map);
+		return NULL;
+	}
+	vma->alloc_page = map_alloc_page;
+	vma->map = map;
+	vma->ofs = offset;
+
+	/* Populating is best effort: pages that cannot be brought in now
+	 * are left to fault in. */
+	if (populate)
+		for (i = 0; i < page_cnt; i++)
+			vm_claim_page ((uint8_t *) addr + i * PGSIZE);
+	return addr;
 }
 
 /* Do the munmap */
+/* Unmaps the mapping that do_mmap() created at ADDR: the area there
+ * and the areas madvise() split off it, with their pages.  What was
+ * written through the mapping is written back first. */
 void
 do_munmap (void *addr) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct vma *vma = vma_find (spt, addr);
+	struct mmap_file *map;
+
+	if (vma == NULL || vma->map == NULL || vma->map->addr != addr)
+		return;
+	map = vma->map;
+	while (vma != NULL && vma->map == map) {
+		struct vma *next = vma_next (spt, vma->end);
+
+		if (next != NULL && next->start != vma->end)
+			next = NULL;
+		if (vma->writable)
+			file_backed_sync (vma, vma->start, vma->end);
+		spt_remove_range (spt, vma->start, vma->end);
+		vma_remove (spt, vma);
+		vma = next;
+	}
+}
+
+/* Writes back the pages of file mappings in the LENGTH bytes at
+ * ADDR, which must be page-aligned, that were written since they
+ * were last cleaned, and waits for the writes to finish.  Returns 0
+ * if successful, -1 if the arguments are invalid. */
+int
+do_msync (void *addr, size_t length) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *start = addr, *end;
+	struct vma *vma;
+	size_t page_cnt;
+
+	if (pg_ofs (addr) != 0 || !is_user_vaddr (addr))
+		return -1;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if (page_cnt > ((uint64_t) KERN_BASE - (uint64_t) addr) / PGSIZE)
+		return -1;
+	end = start + page_cnt * PGSIZE;
+
+	for (vma = vma_next (spt, start); vma != NULL && vma->start < end;
+			vma = vma_next (spt, vma->end))
+		if (vma->map != NULL)
+			file_backed_sync (vma, vma->start > start ? vma->start : start,
+					vma->end < end ? vma->end : end);
+	return 0;
 }
@@ -8,6 +8,8 @@
  * function.
  * */
 
+#include "threads/malloc.h"
+#include "threads/mmu.h"
 #include "vm/vm.h"
 #include "vm/uninit.h"
 
@@ -59,10 +61,20 @@ uninit_initialize (struct page *page, void *kva) {
 /* Free the resources hold by uninit_page. Although most of pages are transmuted
  * to other page objects, it is possible to have uninit pages when the process
  * exit, which are never referenced during the execution.
+ * AUX is owned by the page until its initializer runs, and is freed
+ * here otherwise.
  * PAGE will be freed by the caller. */
 static void
 uninit_destroy (struct page *page) {
-	struct uninit_page *uninit UNUSED = &page->uninit;
-	/* TODO: Fill this function.
-	 * TODO: If you don't have anything to do, just return. */
+	struct uninit_page *uninit = &page->uninit;
+
+	/* A pending mapped page holds a reference to its mapping. */
+	if (VM_TYPE (uninit->type) == VM_FILE && uninit->aux != NULL)
+		mmap_file_put (((struct file_page *) uninit->aux)->map);
+	free (uninit->aux);
+
+	/* The page may still map the shared zero page, which must not be
+	 * freed along with the page table. */
+	if (page->owner->pml4 != NULL)
+		pml4_clear_page (page->owner->pml4, page->va);
 }
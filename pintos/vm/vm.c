@@ -1,8 +1,107 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "userprog/uaccess.h"
+#include "intrinsic.h"
+
+/* Frame table.
+ * Every frame handed out to user pages lives on FRAME_TABLE, in the
+ * order the clock hand visits them.  FRAME_LOCK protects the table,
+ * the hand, each frame's page list and pin count, and page->frame.
+ * Eviction drops it while the victim is written out, leaving the
+ * frame pinned, unmapped and marked EVICTING; whoever needs a page
+ * of such a frame waits on EVICT_DONE until the eviction is over. */
+static struct list frame_table;
+static struct lock frame_lock;
+static struct condition evict_done;
+static struct list_elem *clock_hand;
+
+/* Eviction statistics. */
+static long long evict_cnt;     /* # of frames evicted. */
+static long long scan_cnt;      /* # of frames examined by the clock. */
+static long long scan_max;      /* Longest scan for a single victim. */
+
+/* Copy-on-write statistics. */
+static long long cow_copy_cnt;  /* # of shared frames copied on write. */
+static long long cow_reuse_cnt; /* # of write faults on a last sharer. */
+
+/* A page of zeros, mapped read-only for reads of anonymous pages
+ * that were never written. */
+static void *zero_page;
+static long long zero_map_cnt;  /* # of faults served by ZERO_PAGE. */
+static long long large_page_cnt; /* # of 2 MiB pages mapped on faults. */
+
+/* Number of pages, the faulting one included, that a fault on
+ * contents loaded from a file resolves at once.  Set with -fa. */
+size_t vm_fault_around = FAULT_AROUND_MAX;
+static long long fault_around_cnt;  /* # of pages loaded around faults. */
+static long long swap_ra_fault_cnt; /* # of swap-in faults that read ahead. */
+
+/* Page fault statistics of all processes since boot, protected by
+ * disabling interrupts.  Each process keeps its own as well, which
+ * are printed when it exits if -fs is given. */
+static struct fault_stats fault_stats;
+bool vm_print_faults;
+static const char *fault_cause_names[FAULT_CAUSE_CNT] = {
+	"lazy-load", "zero-fill", "swap-in", "copy-on-write", "stack growth",
+	"file", "invalid",
+};
+
+/* Same-page merging.  With -ksm=COUNT, ksmd looks at COUNT frames
+ * every KSM_SLEEP ticks and merges anonymous frames with identical
+ * contents into one frame, mapped read-only by all of their pages,
+ * which vm_handle_wp() unshares again on a write.  Frames whose
+ * checksum held still since ksmd's previous visit are indexed by
+ * checksum in KSM_INDEX.  FRAME_LOCK protects the index and the
+ * cursor. */
+size_t vm_ksm_pages;
+#define KSM_SLEEP (TIMER_FREQ / 50)
+static struct hash ksm_index;
+static struct list_elem *ksm_cursor;
+static long long ksm_scan_cnt;  /* # of frames examined by ksmd. */
+static hash_hash_func ksm_hash;
+static hash_less_func ksm_less;
+static void ksm_unindex (struct frame *frame);
+static void ksm_print_stats (void);
+static void ksmd (void *aux);
+
+/* Background reclaim.  kswapd sleeps until the free frames of the
+ * user pool drop below WMARK_LOW, then evicts frames, KSWAPD_BATCH
+ * at a time, until WMARK_HIGH are free, so that faults find a free
+ * frame instead of each evicting one.  A fault that still finds none
+ * evicts one itself.  KSWAPD_IDLE is protected by disabling
+ * interrupts. */
+static size_t wmark_low, wmark_high;
+#define KSWAPD_BATCH SWAP_CLUSTER
+#define KSWAPD_BACKOFF (TIMER_FREQ / 100)
+static struct semaphore kswapd_sema;
+static bool kswapd_idle;
+static long long kswapd_cnt;    /* # of frames reclaimed by kswapd. */
+static long long direct_cnt;    /* # of frames evicted by faults. */
+static void kswapd (void *aux);
+
+/* Supplemental page table radix tree.  Each node resolves SPT_BITS
+ * bits of a page number, the root the most significant, and
+ * SPT_LEVELS levels cover every user page number.  A leaf node's
+ * slots point to pages, any other node's to the nodes below it.
+ * Nodes are created as pages are added and freed once they empty. */
+#define SPT_BITS 6
+#define SPT_FANOUT (1 << SPT_BITS)
+#define SPT_LEVELS 5
+struct spt_node {
+	void *slots[SPT_FANOUT];     /* Children, or pages at the leaves. */
+	size_t used;                 /* Number of non-null SLOTS. */
+};
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -10,12 +109,55 @@ void
 vm_init (void) {
 	vm_anon_init ();
 	vm_file_init ();
-#ifdef EFILESYS  /* For project 4 */
-	pagecache_init ();
-#endif
+	page_cache_init ();
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
-	/* TODO: Your code goes here. */
+	list_init (&frame_table);
+	lock_init (&frame_lock);
+	cond_init (&evict_done);
+	clock_hand = NULL;
+	zero_page = palloc_get_page (PAL_ZERO);
+	if (zero_page == NULL)
+		PANIC ("vm_init: cannot allocate the zero page");
+	hash_init (&ksm_index, ksm_hash, ksm_less, NULL);
+	ksm_cursor = NULL;
+	if (vm_ksm_pages > 0
+			&& thread_create ("ksmd", PRI_DEFAULT, ksmd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start ksmd");
+	wmark_low = palloc_free_cnt (PAL_USER) / 32;
+	wmark_high = 2 * wmark_low;
+	sema_init (&kswapd_sema, 0);
+	if (thread_create ("kswapd", PRI_DEFAULT, kswapd, NULL) == TID_ERROR)
+		PANIC ("vm_init: cannot start kswapd");
+}
+
+/* Prints frame table statistics. */
+void
+vm_print_stats (void) {
+	printf ("Frame table: %lld evictions, %lld frames scanned, "
+			"%lld max per eviction\n", evict_cnt, scan_cnt, scan_max);
+	printf ("Copy-on-write: %lld frames copied, %lld reused, "
+			"%lld zero page mappings\n",
+			cow_copy_cnt, cow_reuse_cnt, zero_map_cnt);
+	printf ("Fault-around: %lld pages loaded, %lld swap-ins read ahead, "
+			"%lld large pages\n",
+			fault_around_cnt, swap_ra_fault_cnt, large_page_cnt);
+	printf ("Reclaim: %lld frames by kswapd, %lld by faults\n",
+			kswapd_cnt, direct_cnt);
+	vm_print_fault_stats ("Page faults", &fault_stats);
+	ksm_print_stats ();
+	vm_anon_print_stats ();
+	page_cache_print_stats ();
+}
+
+/* Returns the thread whose address space the current thread runs
+ * in: the parent it borrowed it from with vfork(), until it calls
+ * exec or exits, or else itself. */
+struct thread *
+vm_owner (void) {
+	struct thread *t = thread_current ();
+
+	return t->vfork_parent != NULL ? t->vfork_parent : t;
 }
 
 /* Get the type of the page. This function is useful if you want to know the
@@ -35,7 +177,11 @@ page_get_type (struct page *page) {
 /* Helpers */
 static struct frame *vm_get_victim (void);
 static bool vm_do_claim_page (struct page *page);
+static bool vm_claim_into (struct page *page, struct frame *frame);
 static struct frame *vm_evict_frame (void);
+static void vm_release_frame (struct frame *frame);
+static struct page *vm_alloc_vma_page (struct supplemental_page_table *spt,
+		struct vma *vma, void *va);
 
 /* Create the pending page object with initializer. If you want to create a
  * page, do not create it directly and make it through this function or
@@ -46,98 +192,1494 @@ vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
 
 	ASSERT (VM_TYPE(type) != VM_UNINIT)
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	bool (*initializer) (struct page *, enum vm_type, void *);
+	struct page *page;
+	struct vma *vma;
+
+	upage = pg_round_down (upage);
 
 	/* Check wheter the upage is already occupied or not. */
 	if (spt_find_page (spt, upage) == NULL) {
-		/* TODO: Create the page, fetch the initialier according to the VM type,
-		 * TODO: and then create "uninit" page struct by calling uninit_new. You
-		 * TODO: should modify the field after calling the uninit_new. */
+		switch (VM_TYPE (type)) {
+			case VM_ANON:
+				initializer = anon_initializer;
+				break;
+			case VM_FILE:
+				initializer = file_backed_initializer;
+				break;
+			default:
+				goto err;
+		}
 
-		/* TODO: Insert the page into the spt. */
+		page = malloc (sizeof *page);
+		if (page == NULL)
+			goto err;
+		uninit_new (page, upage, init, type, aux, initializer);
+		page->owner = vm_owner ();
+		page->writable = writable;
+		vma = vma_find (spt, upage);
+		page->advice = vma != NULL ? vma->advice : MADV_NORMAL;
+
+		if (!spt_insert_page (spt, page)) {
+			free (page);
+			goto err;
+		}
+		return true;
 	}
 err:
 	return false;
 }
 
+/* Returns the index into a node at LEVEL, 0 being the root, of the
+ * slot for page number PG_NO. */
+static size_t
+spt_index (uint64_t pg_no, int level) {
+	return (pg_no >> ((SPT_LEVELS - 1 - level) * SPT_BITS)) & (SPT_FANOUT - 1);
+}
+
 /* Find VA from spt and return page. On error, return NULL. */
 struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function. */
+spt_find_page (struct supplemental_page_table *spt, void *va) {
+	uint64_t pn = pg_no (va);
+	struct spt_node *node = spt->pages;
+	int level;
 
-	return page;
+	if (pn >> (SPT_LEVELS * SPT_BITS) != 0)
+		return NULL;
+	for (level = 0; node != NULL && level < SPT_LEVELS - 1; level++)
+		node = node->slots[spt_index (pn, level)];
+	return node != NULL ? node->slots[spt_index (pn, SPT_LEVELS - 1)] : NULL;
 }
 
-/* Insert PAGE into spt with validation. */
+/* Insert PAGE into spt with validation.
+ * Nodes created on the way down are kept if a later allocation
+ * fails; supplemental_page_table_kill() frees them. */
 bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	int succ = false;
-	/* TODO: Fill this function. */
+spt_insert_page (struct supplemental_page_table *spt,
+		struct page *page) {
+	uint64_t pn = pg_no (page->va);
+	struct spt_node *node;
+	void **slot;
+	int level;
 
-	return succ;
+	if (pn >> (SPT_LEVELS * SPT_BITS) != 0)
+		return false;
+	if (spt->pages == NULL) {
+		spt->pages = calloc (1, sizeof *spt->pages);
+		if (spt->pages == NULL)
+			return false;
+	}
+	node = spt->pages;
+	for (level = 0; level < SPT_LEVELS - 1; level++) {
+		slot = &node->slots[spt_index (pn, level)];
+		if (*slot == NULL) {
+			*slot = calloc (1, sizeof *node);
+			if (*slot == NULL)
+				return false;
+			node->used++;
+		}
+		node = *slot;
+	}
+	slot = &node->slots[spt_index (pn, SPT_LEVELS - 1)];
+	if (*slot != NULL)
+		return false;
+	*slot = page;
+	node->used++;
+	return true;
 }
 
+/* Removes PAGE from spt, freeing the nodes this empties, and
+ * frees PAGE. */
 void
 spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	uint64_t pn = pg_no (page->va);
+	struct spt_node *path[SPT_LEVELS];
+	struct spt_node *node = spt->pages;
+	int level;
+
+	for (level = 0; level < SPT_LEVELS; level++) {
+		ASSERT (node != NULL);
+		path[level] = node;
+		node = node->slots[spt_index (pn, level)];
+	}
+	ASSERT ((void *) node == page);
+
+	for (level = SPT_LEVELS - 1; level >= 0; level--) {
+		path[level]->slots[spt_index (pn, level)] = NULL;
+		if (--path[level]->used > 0)
+			break;
+		free (path[level]);
+		if (level == 0)
+			spt->pages = NULL;
+	}
 	vm_dealloc_page (page);
-	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
+/* Returns the page of spt with the lowest address in [VA, END), or a
+ * null pointer if there is none.  Subtrees without pages are skipped
+ * whole, so walking a range costs time in proportion to the pages
+ * it holds rather than to its size. */
+struct page *
+spt_next_page (struct supplemental_page_table *spt, const void *va,
+		const void *end) {
+	uint64_t pn = pg_no (va);
+	uint64_t last = pg_no (pg_round_up (end));
+
+	while (pn < last) {
+		struct spt_node *node = spt->pages;
+		uint64_t span = (uint64_t) 1 << (SPT_LEVELS * SPT_BITS);
+		int level;
+
+		for (level = 0; node != NULL && level < SPT_LEVELS; level++) {
+			void *slot = node->slots[spt_index (pn, level)];
+
+			span >>= SPT_BITS;
+			if (level == SPT_LEVELS - 1 && slot != NULL)
+				return slot;
+			node = slot;
+		}
+		/* Nothing in the SPAN pages around PN. */
+		pn = (pn & ~(span - 1)) + span;
+	}
+	return NULL;
+}
+
+/* Removes and frees the pages of spt in [START, END). */
+void
+spt_remove_range (struct supplemental_page_table *spt, void *start,
+		void *end) {
+	struct page *page;
+
+	while ((page = spt_next_page (spt, start, end)) != NULL) {
+		start = (uint8_t *) page->va + PGSIZE;
+		spt_remove_page (spt, page);
+	}
+}
+
+/* Returns the frame under *HAND, the clock hand or ksmd's cursor,
+ * and advances it.  FRAME_TABLE must not be empty. */
+static struct frame *
+clock_advance (struct list_elem **hand) {
+	struct frame *frame;
+
+	if (*hand == NULL || *hand == list_end (&frame_table))
+		*hand = list_begin (&frame_table);
+	frame = list_entry (*hand, struct frame, elem);
+	*hand = list_next (*hand);
+	return frame;
+}
+
+/* Returns true if FRAME was accessed by the kernel or through any
+ * mapping since the last call, clearing the accessed bits. */
+static bool
+frame_referenced (struct frame *frame) {
+	bool accessed = frame->accessed;
+	struct list_elem *e;
+
+	frame->accessed = false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4;
+
+		if (page->owner == NULL)
+			continue;
+		pml4 = page->owner->pml4;
+		if (pml4_is_accessed (pml4, page->va)) {
+			pml4_set_accessed (pml4, page->va, false);
+			accessed = true;
+			if (VM_TYPE (page->operations->type) == VM_ANON)
+				anon_ra_used (page, true);
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if FRAME was written through any of its mappings. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->dirty)
+		return true;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (page->owner != NULL && pml4_is_dirty (page->owner->pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Get the struct frame, that will be evicted.
+ * Second-chance clock that prefers clean frames: the first sweep
+ * takes the first frame that is neither recently accessed nor dirty,
+ * clearing accessed bits as it goes and remembering the first dirty
+ * candidate.  If a full sweep finds no clean frame the dirty candidate
+ * is used, and failing that a second sweep takes whatever it finds
+ * first.  Pinned frames are never chosen.  Must be called with
+ * FRAME_LOCK held. */
 static struct frame *
 vm_get_victim (void) {
 	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+	struct frame *dirty_victim = NULL;
+	size_t frame_cnt = list_size (&frame_table);
+	size_t scanned;
+
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	for (scanned = 0; scanned < 2 * frame_cnt; scanned++) {
+		struct frame *frame;
+
+		if (scanned == frame_cnt && dirty_victim != NULL)
+			break;
+		frame = clock_advance (&clock_hand);
+		if (frame->pin_cnt > 0 || frame->page == NULL)
+			continue;
+		if (frame_referenced (frame))
+			continue;
+		if (scanned >= frame_cnt || !frame_is_dirty (frame)) {
+			victim = frame;
+			scanned++;
+			break;
+		}
+		if (dirty_victim == NULL)
+			dirty_victim = frame;
+	}
+	if (victim == NULL)
+		victim = dirty_victim;
 
+	scan_cnt += scanned;
+	if ((long long) scanned > scan_max)
+		scan_max = scanned;
 	return victim;
 }
 
+/* Returns true if FRAME is mapped by a single page, which may then
+ * write to it directly.  Frames shared after fork are mapped
+ * read-only until vm_handle_wp() gives the writer its own copy. */
+static bool
+frame_exclusive (struct frame *frame) {
+	return list_begin (&frame->pages) == list_rbegin (&frame->pages);
+}
+
+/* Returns true if PAGE may map FRAME writable.  A file mapping
+ * writes to the page cache frame it shares, but only once the frame
+ * is marked dirty, so that writes are noticed; any other page only
+ * while it is the frame's sole mapping. */
+static bool
+frame_writable_by (struct frame *frame, struct page *page) {
+	if (!page->writable)
+		return false;
+	if (VM_TYPE (page->operations->type) == VM_FILE)
+		return frame->dirty;
+	return frame_exclusive (frame);
+}
+
+/* Removes every mapping of FRAME from its owners' page tables. */
+static void
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (page->owner != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+	}
+}
+
+/* Undoes frame_unmap(). */
+static void
+frame_remap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (page->owner != NULL)
+			pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					frame_writable_by (frame, page));
+	}
+}
+
+/* Maps every user mapping of FRAME read-only, keeping its accessed
+ * bit, so that the next write through it faults. */
+static void
+frame_write_protect (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4;
+		bool accessed;
+
+		if (page->owner == NULL)
+			continue;
+		pml4 = page->owner->pml4;
+		accessed = pml4_is_accessed (pml4, page->va);
+		pml4_set_page (pml4, page->va, frame->kva, false);
+		pml4_set_accessed (pml4, page->va, accessed);
+	}
+}
+
+/* Detaches every page from FRAME, whose contents now live
+ * elsewhere. */
+static void
+frame_detach (struct frame *frame) {
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+		page->frame = NULL;
+	}
+	frame->page = NULL;
+	frame->dirty = false;
+	frame->accessed = false;
+	ksm_unindex (frame);
+	frame->ksm = false;
+}
+
+/* Removes FRAME from the frame table.  Must be called with
+ * FRAME_LOCK held. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (clock_hand == &frame->elem)
+		clock_hand = list_next (clock_hand);
+	if (ksm_cursor == &frame->elem)
+		ksm_cursor = list_next (ksm_cursor);
+	ksm_unindex (frame);
+	list_remove (&frame->elem);
+}
+
+/* Waits until PAGE's frame, if any, is not being evicted, and
+ * returns it: a null pointer if the eviction took the page out.
+ * Must be called with FRAME_LOCK held. */
+static struct frame *
+frame_wait_eviction (struct page *page) {
+	ASSERT (lock_held_by_current_thread (&frame_lock));
+
+	while (page->frame != NULL && page->frame->evicting)
+		cond_wait (&evict_done, &frame_lock);
+	return page->frame;
+}
+
+/* Ends the eviction of FRAME and wakes up those waiting for it.
+ * Must be called with FRAME_LOCK held. */
+static void
+frame_end_eviction (struct frame *frame) {
+	frame->evicting = false;
+	cond_broadcast (&evict_done, &frame_lock);
+}
+
+/* Returns true if FRAME may be swapped out in the same cluster as
+ * PAGE, because it holds the anonymous page right after PAGE in
+ * the same address space (or right before it, if DIR is -1), is
+ * mapped only there, and is neither pinned nor recently used. */
+static bool
+cluster_candidate (struct frame *frame, struct page *page, int dir) {
+	struct page *next = frame->page;
+
+	if (frame->pin_cnt > 0 || next == NULL || !frame_exclusive (frame))
+		return false;
+	return VM_TYPE (next->operations->type) == VM_ANON
+		&& next->owner == page->owner
+		&& (uint8_t *) next->va == (uint8_t *) page->va + dir * PGSIZE
+		&& !pml4_is_accessed (next->owner->pml4, next->va);
+}
+
+/* Fills CLUSTER with VICTIM's anonymous page and up to
+ * SWAP_CLUSTER - 1 of its neighbours, in address order, and
+ * returns how many pages it holds.  Neighbours are looked for among
+ * the frames next to VICTIM in the frame table: pages faulted in
+ * one after another get neighbouring frames, and the clock hand
+ * recycles frames in the same order.  The extra frames are pinned,
+ * unmapped and marked as being evicted.  Must be called with
+ * FRAME_LOCK held. */
+static size_t
+gather_cluster (struct frame *victim, struct page **cluster) {
+	struct page *before[SWAP_CLUSTER];
+	size_t before_cnt = 0, cnt = 0;
+	struct page *edge;
+	struct list_elem *e;
+
+	edge = victim->page;
+	for (e = list_prev (&victim->elem);
+			e != list_rend (&frame_table) && before_cnt < SWAP_CLUSTER - 1;
+			e = list_prev (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		if (!cluster_candidate (frame, edge, -1))
+			break;
+		edge = before[before_cnt++] = frame->page;
+	}
+	while (before_cnt > 0)
+		cluster[cnt++] = before[--before_cnt];
+	cluster[cnt++] = victim->page;
+
+	edge = victim->page;
+	for (e = list_next (&victim->elem);
+			e != list_end (&frame_table) && cnt < SWAP_CLUSTER;
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		if (!cluster_candidate (frame, edge, 1))
+			break;
+		edge = cluster[cnt++] = frame->page;
+	}
+
+	for (size_t i = 0; i < cnt; i++)
+		if (cluster[i] != victim->page) {
+			cluster[i]->frame->pin_cnt++;
+			cluster[i]->frame->evicting = true;
+			frame_unmap (cluster[i]->frame);
+		}
+	return cnt;
+}
+
+/* Finishes the eviction of the CNT pages in CLUSTER, which
+ * gather_cluster() formed around VICTIM: if they were written out,
+ * frees the neighbours' frames, otherwise maps them back.  Must be
+ * called with FRAME_LOCK held. */
+static void
+finish_cluster (struct frame *victim, struct page **cluster, size_t cnt,
+		bool success) {
+	for (size_t i = 0; i < cnt; i++) {
+		struct frame *frame = cluster[i]->frame;
+		if (frame == victim)
+			continue;
+		if (success) {
+			frame_detach (frame);
+			frame_table_remove (frame);
+			palloc_free_page (frame->kva);
+			free (frame);
+		} else {
+			frame_remap (frame);
+			frame->pin_cnt--;
+			frame->evicting = false;
+		}
+	}
+	if (success)
+		evict_cnt += cnt - 1;
+	cond_broadcast (&evict_done, &frame_lock);
+}
+
 /* Evict one page and return the corresponding frame.
+ * Every mapping is removed before the contents are written out, so
+ * nobody can modify the frame behind the pager's back.  Anonymous
+ * victims take their swappable neighbours along in the same write,
+ * which leaves free frames behind for the faults that follow.
+ * FRAME_LOCK is only held to pick and unmap the victims and then to
+ * detach or remap them; the disk writes run without it.  The frame
+ * is returned pinned, with no pages.
  * Return NULL on error.*/
 static struct frame *
 vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
+	struct page *cluster[SWAP_CLUSTER];
+	size_t cnt = 0;
+	struct frame *victim;
+	bool clustered, success;
 
-	return NULL;
+	lock_acquire (&frame_lock);
+	victim = vm_get_victim ();
+	if (victim == NULL) {
+		lock_release (&frame_lock);
+		return NULL;
+	}
+	victim->pin_cnt++;
+	victim->evicting = true;
+	victim->dirty = frame_is_dirty (victim);
+	frame_unmap (victim);
+	if (VM_TYPE (victim->page->operations->type) == VM_ANON)
+		cnt = gather_cluster (victim, cluster);
+	lock_release (&frame_lock);
+
+	clustered = cnt > 1 && anon_swap_out_cluster (cluster, cnt);
+	success = clustered || swap_out (victim->page);
+
+	lock_acquire (&frame_lock);
+	finish_cluster (victim, cluster, cnt, clustered);
+	if (!success) {
+		/* Put the mappings back; the caller runs out of memory. */
+		frame_remap (victim);
+		victim->pin_cnt--;
+	} else {
+		frame_detach (victim);
+		evict_cnt++;
+	}
+	frame_end_eviction (victim);
+	lock_release (&frame_lock);
+	return success ? victim : NULL;
+}
+
+/* Wakes kswapd if free frames have run low and it is idle. */
+static void
+kswapd_wake (void) {
+	enum intr_level old_level;
+
+	if (palloc_free_cnt (PAL_USER) >= wmark_low)
+		return;
+	old_level = intr_disable ();
+	if (kswapd_idle) {
+		kswapd_idle = false;
+		sema_up (&kswapd_sema);
+	}
+	intr_set_level (old_level);
+}
+
+/* Returns a new frame for the user pool page at KVA, pinned and
+ * added to the frame table. */
+static struct frame *
+frame_create (void *kva) {
+	struct frame *frame = malloc (sizeof *frame);
+
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		PANIC ("vm_get_frame: out of kernel memory");
+	}
+	frame->kva = kva;
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->pin_cnt = 1;
+	frame->evicting = false;
+	frame->dirty = false;
+	frame->accessed = false;
+	frame->checksum = 0;
+	frame->ksm = false;
+	frame->ksm_indexed = false;
+
+	lock_acquire (&frame_lock);
+	list_push_back (&frame_table, &frame->elem);
+	lock_release (&frame_lock);
+	return frame;
+}
+
+/* Returns a new frame from the free pages of the user pool, pinned
+ * and added to the frame table, or a null pointer if the pool is
+ * empty. */
+static struct frame *
+vm_alloc_frame (void) {
+	void *kva = palloc_get_page (PAL_USER);
+
+	kswapd_wake ();
+	return kva != NULL ? frame_create (kva) : NULL;
 }
 
 /* palloc() and get frame. If there is no available page, evict the page
  * and return it. This always return valid address. That is, if the user pool
  * memory is full, this function evicts the frame to get the available memory
- * space.*/
+ * space.
+ * The frame is returned pinned; vm_do_claim_page() unpins it once the
+ * page is loaded and mapped. */
 static struct frame *
 vm_get_frame (void) {
-	struct frame *frame = NULL;
-	/* TODO: Fill this function. */
+	struct frame *frame = vm_alloc_frame ();
+
+	if (frame == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			PANIC ("vm_get_frame: no frame to evict");
+		direct_cnt++;
+	}
 
 	ASSERT (frame != NULL);
 	ASSERT (frame->page == NULL);
 	return frame;
 }
 
-/* Growing the stack. */
+/* Removes FRAME, which must have no pages, from the frame table and
+ * frees it. */
+static void
+vm_release_frame (struct frame *frame) {
+	ASSERT (list_empty (&frame->pages));
+
+	lock_acquire (&frame_lock);
+	frame_table_remove (frame);
+	lock_release (&frame_lock);
+
+	palloc_free_page (frame->kva);
+	free (frame);
+}
+
+/* Unmaps PAGE and detaches it from its frame, if any, freeing the
+ * frame when PAGE was its last mapping.  Page types call this from
+ * their destroy operation.  Waits for an eviction of the frame in
+ * progress to finish first. */
+void
+vm_free_frame (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	frame = frame_wait_eviction (page);
+	if (frame != NULL) {
+		if (page->owner != NULL && page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+		list_remove (&page->frame_elem);
+		page->frame = NULL;
+		if (!list_empty (&frame->pages)) {
+			frame->page = list_entry (list_front (&frame->pages),
+					struct page, frame_elem);
+			frame = NULL;
+		}
+	}
+	lock_release (&frame_lock);
+
+	if (frame != NULL) {
+		frame->page = NULL;
+		vm_release_frame (frame);
+	}
+}
+
+/* Gives PAGE, which has no frame, a frame of its own without loading
+ * or mapping it, evicting another page if there is no free frame.
+ * The frame is left pinned; the caller fills it in and then releases
+ * it with vm_unpin_page(), or with vm_free_frame() on failure.
+ * Returns false if no frame could be found. */
+bool
+vm_reserve_frame (struct page *page) {
+	struct frame *frame = vm_alloc_frame ();
+
+	ASSERT (page->frame == NULL);
+
+	if (frame == NULL) {
+		frame = vm_evict_frame ();
+		if (frame == NULL)
+			return false;
+		direct_cnt++;
+	}
+
+	lock_acquire (&frame_lock);
+	frame->page = page;
+	page->frame = frame;
+	list_push_back (&frame->pages, &page->frame_elem);
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* If PAGE is resident and was written since it was last cleaned,
+ * pins it, marks it clean and write-protects its file mappings, so
+ * that the next write through them is noticed, and returns true.
+ * The caller then writes the contents back and unpins the page. */
+bool
+vm_clean_page (struct page *page) {
+	struct frame *frame;
+	bool dirty = false;
+
+	lock_acquire (&frame_lock);
+	frame = frame_wait_eviction (page);
+	if (frame != NULL && frame_is_dirty (frame)) {
+		frame->pin_cnt++;
+		frame->dirty = false;
+		frame_write_protect (frame);
+		dirty = true;
+	}
+	lock_release (&frame_lock);
+	return dirty;
+}
+
+/* Makes PAGE resident and pins its frame, so that it cannot be
+ * evicted while the kernel accesses it directly or does I/O on it.
+ * Returns false if the page could not be brought in. */
+bool
+vm_pin_page (struct page *page) {
+	for (;;) {
+		lock_acquire (&frame_lock);
+		if (frame_wait_eviction (page) != NULL) {
+			page->frame->pin_cnt++;
+			lock_release (&frame_lock);
+			return true;
+		}
+		lock_release (&frame_lock);
+
+		if (!vm_do_claim_page (page))
+			return false;
+	}
+}
+
+/* Pins PAGE's frame if PAGE is resident and not being evicted,
+ * without bringing it in or waiting.  Returns false otherwise. */
+bool
+vm_pin_resident (struct page *page) {
+	bool pinned;
+
+	lock_acquire (&frame_lock);
+	pinned = page->frame != NULL && !page->frame->evicting;
+	if (pinned)
+		page->frame->pin_cnt++;
+	lock_release (&frame_lock);
+	return pinned;
+}
+
+/* Undoes one vm_pin_page() of PAGE. */
+void
+vm_unpin_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	ASSERT (page->frame != NULL && page->frame->pin_cnt > 0);
+	page->frame->pin_cnt--;
+	lock_release (&frame_lock);
+}
+
+/* Growing the stack.
+ * Adds the demand-zero page at ADDR, in the stack area; the fault
+ * handler loads it. */
+static bool
+vm_stack_growth (void *addr) {
+	return vm_alloc_page (VM_ANON, pg_round_down (addr), true);
+}
+
+/* Returns true if an access at ADDR, in the stack area, may grow
+ * the stack: a push may touch up to 8 bytes below the stack pointer.
+ * An access by the kernel on behalf of a system call goes by the
+ * user stack pointer saved when the call was entered. */
+static bool
+stack_access_ok (const void *addr, struct intr_frame *f, bool user) {
+	uint64_t rsp = user ? f->rsp : thread_current ()->user_rsp;
+
+	return (uint64_t) addr >= rsp - 8;
+}
+
+/* Creates the page at VA, which must not exist yet, from VMA, the
+ * area holding it, and returns it.  Returns a null pointer if VMA's
+ * pages are not created on demand or if out of memory. */
+static struct page *
+vm_alloc_vma_page (struct supplemental_page_table *spt, struct vma *vma,
+		void *va) {
+	va = pg_round_down (va);
+	if (vma->alloc_page == NULL || !vma->alloc_page (vma, va))
+		return NULL;
+	return spt_find_page (spt, va);
+}
+
+/* Returns true if PAGE has never been written and reads as zeros:
+ * a pending anonymous page without an initializer. */
+static bool
+page_is_demand_zero (struct page *page) {
+	return VM_TYPE (page->operations->type) == VM_UNINIT
+		&& VM_TYPE (page->uninit.type) == VM_ANON
+		&& page->uninit.init == NULL;
+}
+
+/* Maps the shared zero page read-only at PAGE, which must be demand
+ * zero, instead of giving it a frame of its own.  The first write
+ * then comes through vm_handle_wp(). */
+static bool
+vm_map_zero_page (struct page *page) {
+	if (!pml4_set_page (page->owner->pml4, page->va, zero_page, false))
+		return false;
+	zero_map_cnt++;
+	return true;
+}
+
+/* Claims PAGE, a demand-zero page being written, together with the
+ * rest of the 2 MiB aligned block holding it, and maps the block with
+ * a single large page, which saves 511 faults and TLB entries.  This
+ * is done only if PAGE's area covers the whole block, no other page
+ * of the block exists yet and the user pool has an aligned run to
+ * spare above the high watermark; it never evicts.  Each page still
+ * gets a frame of its own, so eviction, copy-on-write and unmapping
+ * handle them one at a time, and the large page is split when one of
+ * them changes.  Returns false if PAGE was not claimed, which the
+ * caller then does as usual. */
+static bool
+vm_claim_large_page (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct vma *vma = vma_find (spt, page->va);
+	uint8_t *start = (uint8_t *) ((uint64_t) page->va & ~LARGE_PGMASK);
+	uint8_t *end = start + LARGE_PGSIZE;
+	size_t idx = ((uint8_t *) page->va - start) / PGSIZE;
+	bool complete = true;
+	uint8_t *kpage;
+	size_t i;
+
+	if (vma == NULL || vma->alloc_page == NULL || !page->writable
+			|| page->advice == MADV_RANDOM
+			|| start < vma->start || end > vma->end
+			|| spt_next_page (spt, start, page->va) != NULL
+			|| spt_next_page (spt, (uint8_t *) page->va + PGSIZE, end) != NULL
+			|| palloc_free_cnt (PAL_USER) < wmark_high + LARGE_PGCNT)
+		return false;
+	kpage = palloc_get_large_page (PAL_USER);
+	if (kpage == NULL)
+		return false;
+
+	/* PAGE first, so that failing leaves it as it was. */
+	if (!vm_claim_into (page, frame_create (kpage + idx * PGSIZE))) {
+		for (i = 0; i < LARGE_PGCNT; i++)
+			if (i != idx)
+				palloc_free_page (kpage + i * PGSIZE);
+		return false;
+	}
+
+	/* The rest is best effort: the pages claimed so far stay, and the
+	 * frames left over go back to the pool. */
+	for (i = 0; i < LARGE_PGCNT; i++) {
+		struct page *next;
+
+		if (i == idx)
+			continue;
+		if (!complete) {
+			palloc_free_page (kpage + i * PGSIZE);
+			continue;
+		}
+		next = vm_alloc_vma_page (spt, vma, start + i * PGSIZE);
+		if (next == NULL || !page_is_demand_zero (next)) {
+			if (next != NULL)
+				spt_remove_page (spt, next);
+			palloc_free_page (kpage + i * PGSIZE);
+			complete = false;
+		} else if (!vm_claim_into (next, frame_create (kpage + i * PGSIZE))) {
+			spt_remove_page (spt, next);
+			complete = false;
+		}
+	}
+	if (complete && pml4_merge_large_page (page->owner->pml4, start))
+		large_page_cnt++;
+	return true;
+}
+
+/* Handle the fault on write_protected page.
+ * PAGE is writable but shares its frame copy-on-write, maps the zero
+ * page, or maps a clean page cache frame.  A file mapping marks the
+ * frame dirty and writes to it; the last page left on any other
+ * frame just gets write access back; any other gets a private copy
+ * of the frame. */
+static bool
+vm_handle_wp (struct page *page) {
+	struct frame *frame, *copy;
+
+	lock_acquire (&frame_lock);
+	frame = frame_wait_eviction (page);
+	if (frame == NULL) {
+		lock_release (&frame_lock);
+		/* A zero page mapping gets a private, zeroed frame.
+		 * Otherwise the page was evicted meanwhile and the retry
+		 * faults it back in. */
+		if (pml4_get_page (page->owner->pml4, page->va) == zero_page)
+			return vm_do_claim_page (page);
+		return true;
+	}
+	if (VM_TYPE (page->operations->type) == VM_FILE) {
+		/* A file mapping writes to the page cache frame itself,
+		 * which kworkerd writes back. */
+		frame->dirty = true;
+		pml4_set_page (page->owner->pml4, page->va, frame->kva, true);
+		lock_release (&frame_lock);
+		page_cache_wake_kworkerd (false);
+		return true;
+	}
+	if (frame_exclusive (frame)) {
+		pml4_set_page (page->owner->pml4, page->va, frame->kva, true);
+		lock_release (&frame_lock);
+		cow_reuse_cnt++;
+		return true;
+	}
+	frame->pin_cnt++;
+	lock_release (&frame_lock);
+
+	copy = vm_get_frame ();
+	memcpy (copy->kva, frame->kva, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	frame->pin_cnt--;
+	if (frame_exclusive (frame)) {
+		/* The other sharers went away while the copy was made, so
+		 * PAGE keeps the frame after all. */
+		pml4_set_page (page->owner->pml4, page->va, frame->kva, true);
+		lock_release (&frame_lock);
+		vm_release_frame (copy);
+		cow_reuse_cnt++;
+		return true;
+	}
+	if (!pml4_set_page (page->owner->pml4, page->va, copy->kva, true)) {
+		/* PAGE still maps the shared frame read-only. */
+		lock_release (&frame_lock);
+		vm_release_frame (copy);
+		return false;
+	}
+	list_remove (&page->frame_elem);
+	if (frame->page == page)
+		frame->page = list_entry (list_front (&frame->pages), struct page,
+				frame_elem);
+
+	copy->page = page;
+	page->frame = copy;
+	list_push_back (&copy->pages, &page->frame_elem);
+	copy->pin_cnt--;
+	lock_release (&frame_lock);
+	cow_copy_cnt++;
+	return true;
+}
+
+/* Loads the pending pages around PAGE, which was just brought in
+ * by initializer INIT, that lie in the same area and that INIT would
+ * load as well: the rest of the same segment or mapping.  Pages of
+ * the area not created yet are created for the purpose, and removed
+ * again if they cannot be loaded.  The window is vm_fault_around
+ * pages, aligned to its size, so that a sequential scan faults once
+ * per window; pages advised MADV_SEQUENTIAL always get the largest
+ * window, and pages advised MADV_RANDOM none.  Only free frames are
+ * used; fault-around never evicts.  Around a file mapping, the pages
+ * already in the page cache are mapped, without any I/O.  The pages
+ * are mapped with the accessed bit clear, which leaves them first in
+ * line for eviction if they go unused. */
+static void
+vm_fault_around_page (struct page *page, vm_initializer *init) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	struct vma *vma = vma_find (spt, page->va);
+	bool file = page_get_type (page) == VM_FILE;
+	size_t window = vm_fault_around;
+	uint8_t *start;
+	size_t i;
+
+	if (page->advice == MADV_SEQUENTIAL)
+		window = FAULT_AROUND_MAX;
+	if (vma == NULL || window <= 1 || page->advice == MADV_RANDOM)
+		return;
+	if (window > FAULT_AROUND_MAX)
+		window = FAULT_AROUND_MAX;
+	start = (uint8_t *) page->va - pg_no (page->va) % window * PGSIZE;
+
+	for (i = 0; i < window; i++) {
+		uint8_t *va = start + i * PGSIZE;
+		struct page *next;
+		bool created = false, loaded = false, stop = false;
+
+		if (va == page->va || va < vma->start || va >= vma->end)
+			continue;
+		next = spt_find_page (spt, va);
+		if (next == NULL) {
+			next = vm_alloc_vma_page (spt, vma, va);
+			if (next == NULL)
+				break;
+			created = true;
+		}
+		if (next->frame != NULL)
+			continue;
+		if (file)
+			loaded = page_get_type (next) == VM_FILE
+				&& file_backed_claim (next, false);
+		else if (VM_TYPE (next->operations->type) == VM_UNINIT
+				&& next->uninit.init == init) {
+			struct frame *frame = vm_alloc_frame ();
+
+			loaded = frame != NULL && vm_claim_into (next, frame);
+			stop = !loaded;
+		}
+
+		if (loaded) {
+			pml4_set_accessed (next->owner->pml4, next->va, false);
+			fault_around_cnt++;
+		} else if (created)
+			spt_remove_page (spt, next);
+		if (stop)
+			break;
+	}
+}
+
+/* Returns true if NEXT, the page DIST pages away from PAGE, may be
+ * swapped in together with PAGE: it is a non-resident anonymous
+ * page of the same address space whose contents sit DIST slots away
+ * from PAGE's on the swap disk. */
+static bool
+swap_ra_candidate (struct page *next, struct page *page, int dist) {
+	return next != NULL && VM_TYPE (next->operations->type) == VM_ANON
+		&& next->frame == NULL && next->anon.zswap == NULL
+		&& next->anon.slot != SWAP_NONE
+		&& next->anon.slot == page->anon.slot + dist;
+}
+
+/* Gives PAGE, which has no frame, FRAME, which must be pinned and
+ * empty, and maps it there.  The contents are read in afterwards,
+ * which is safe because the frame stays pinned and the owner is
+ * waiting on the fault.  Returns false, releasing FRAME, if the
+ * mapping fails. */
+static bool
+swap_ra_attach (struct page *page, struct frame *frame) {
+	lock_acquire (&frame_lock);
+	frame->page = page;
+	page->frame = frame;
+	list_push_back (&frame->pages, &page->frame_elem);
+	lock_release (&frame_lock);
+	if (pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->writable))
+		return true;
+
+	lock_acquire (&frame_lock);
+	list_remove (&page->frame_elem);
+	page->frame = NULL;
+	frame->page = NULL;
+	lock_release (&frame_lock);
+	vm_release_frame (frame);
+	return false;
+}
+
+/* Returns the page DIST pages away from PAGE if it may be swapped
+ * in together with PAGE and a free frame could be attached to it,
+ * otherwise a null pointer. */
+static struct page *
+swap_ra_neighbour (struct page *page, int dist) {
+	uint8_t *va = (uint8_t *) page->va + dist * PGSIZE;
+	struct page *next;
+	struct frame *frame;
+
+	if (va < (uint8_t *) PGSIZE || !is_user_vaddr (va))
+		return NULL;
+	next = spt_find_page (&page->owner->spt, va);
+	if (!swap_ra_candidate (next, page, dist))
+		return NULL;
+	frame = vm_alloc_frame ();
+	if (frame == NULL || !swap_ra_attach (next, frame))
+		return NULL;
+	return next;
+}
+
+/* Swaps in PAGE, an anonymous page out on the swap disk, together
+ * with the pages around it whose contents sit in the adjacent slots,
+ * all with a single disk read.  Clustered swap-out writes
+ * neighbouring pages to neighbouring slots, so these are likely to
+ * be touched next.  The pages after PAGE are preferred to the ones
+ * before it, up to the window anon_swap_ra_window() picks, or
+ * SWAP_RA_MAX for pages advised MADV_SEQUENTIAL.  As in fault-around,
+ * only free frames are used for the extra pages, which are mapped
+ * with the accessed bit clear. */
+static bool
+vm_swap_in_around (struct page *page) {
+	struct page *cluster[SWAP_RA_MAX];
+	struct page *before[SWAP_RA_MAX];
+	size_t window = anon_swap_ra_window ();
+	size_t before_cnt = 0, cnt = 0, i;
+	struct page *next;
+
+	if (page->advice == MADV_SEQUENTIAL)
+		window = SWAP_RA_MAX;
+	if (!swap_ra_attach (page, vm_get_frame ()))
+		return false;
+
+	cluster[cnt++] = page;
+	while (cnt < window && (next = swap_ra_neighbour (page, cnt)) != NULL)
+		cluster[cnt++] = next;
+	while (cnt + before_cnt < window
+			&& (next = swap_ra_neighbour (page, -(int) before_cnt - 1)) != NULL)
+		before[before_cnt++] = next;
+	if (before_cnt > 0) {
+		memmove (cluster + before_cnt, cluster, cnt * sizeof *cluster);
+		for (i = 0; i < before_cnt; i++)
+			cluster[before_cnt - 1 - i] = before[i];
+		cnt += before_cnt;
+	}
+
+	anon_swap_in_cluster (cluster, cnt, page);
+	if (cnt > 1)
+		swap_ra_fault_cnt++;
+
+	lock_acquire (&frame_lock);
+	for (i = 0; i < cnt; i++) {
+		if (cluster[i] != page)
+			pml4_set_accessed (page->owner->pml4, cluster[i]->va, false);
+		cluster[i]->frame->pin_cnt--;
+	}
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Clears the accessed bits of PAGE's frame, if it is resident, so
+ * that the clock reclaims it on its next pass. */
 static void
-vm_stack_growth (void *addr UNUSED) {
+vm_deactivate_page (struct page *page) {
+	lock_acquire (&frame_lock);
+	if (frame_wait_eviction (page) != NULL)
+		frame_referenced (page->frame);
+	lock_release (&frame_lock);
 }
 
-/* Handle the fault on write_protected page */
+/* Called on a fault on PAGE, advised MADV_SEQUENTIAL.  When the
+ * fault enters a new fault-around window, the pages of the window
+ * before it, which the scan has left behind, are deactivated, so
+ * that they are evicted before anything else. */
+static void
+vm_drop_behind (struct page *page) {
+	struct supplemental_page_table *spt = &page->owner->spt;
+	size_t window = FAULT_AROUND_MAX;
+	uint8_t *start = page->va;
+	struct page *prev;
+
+	if (pg_no (start) % window != 0 || pg_no (start) < window)
+		return;
+	for (prev = spt_next_page (spt, start - window * PGSIZE, start);
+			prev != NULL;
+			prev = spt_next_page (spt, (uint8_t *) prev->va + PGSIZE, start))
+		vm_deactivate_page (prev);
+}
+
+/* Returns what a not-present fault on PAGE has to do. */
+static enum fault_cause
+page_fault_cause (struct page *page) {
+	if (page_is_demand_zero (page))
+		return FAULT_ZERO;
+	if (page_get_type (page) == VM_FILE)
+		return FAULT_FILE;
+	if (VM_TYPE (page->operations->type) == VM_UNINIT)
+		return FAULT_LAZY;
+	return FAULT_SWAP;
+}
+
+/* Handles the fault at ADDR, as vm_try_handle_fault(), and sets
+ * *CAUSE to what it had to do. */
 static bool
-vm_handle_wp (struct page *page UNUSED) {
+vm_handle_fault (struct intr_frame *f, void *addr, bool user, bool write,
+		bool not_present, enum fault_cause *cause) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct page *page = NULL;
+	struct frame *frame;
+
+	/* Validate the fault. */
+	if (addr == NULL || is_kernel_vaddr (addr))
+		return false;
+
+	page = spt_find_page (spt, addr);
+	if (!not_present) {
+		if (page == NULL)
+			return false;
+		*cause = page_get_type (page) == VM_FILE ? FAULT_FILE : FAULT_COW;
+		return write && page->writable && vm_handle_wp (page);
+	}
+	if (page == NULL) {
+		/* The page is created from the area holding it on first
+		 * touch. */
+		struct vma *vma = vma_find (spt, addr);
+
+		if (vma == NULL)
+			return false;
+		if (vma->stack) {
+			*cause = FAULT_STACK;
+			if (!stack_access_ok (addr, f, user) || !vm_stack_growth (addr))
+				return false;
+			page = spt_find_page (spt, addr);
+		} else {
+			page = vm_alloc_vma_page (spt, vma, addr);
+			if (page == NULL)
+				return false;
+		}
+	}
+	if (write && !page->writable)
+		return false;
+
+	/* PAGE may be on its way out.  If the eviction fails, PAGE stays
+	 * in its frame and only needs mapping. */
+	lock_acquire (&frame_lock);
+	frame = frame_wait_eviction (page);
+	if (frame != NULL) {
+		bool mapped = pml4_get_page (page->owner->pml4, page->va) != NULL
+			|| pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					frame_writable_by (frame, page));
+		lock_release (&frame_lock);
+		return mapped;
+	}
+	lock_release (&frame_lock);
+
+	if (*cause == FAULT_INVALID)
+		*cause = page_fault_cause (page);
+	if (!write && page_is_demand_zero (page))
+		return vm_map_zero_page (page);
+	if (page_is_demand_zero (page) && vm_claim_large_page (page))
+		return true;
+
+	if ((VM_TYPE (page->operations->type) == VM_UNINIT
+				&& page->uninit.init != NULL)
+			|| page_get_type (page) == VM_FILE) {
+		vm_initializer *init = VM_TYPE (page->operations->type) == VM_UNINIT
+			? page->uninit.init : NULL;
+		if (!vm_do_claim_page (page))
+			return false;
+		vm_fault_around_page (page, init);
+	} else if (VM_TYPE (page->operations->type) == VM_ANON
+			&& page->anon.slot != SWAP_NONE && page->advice != MADV_RANDOM) {
+		if (!vm_swap_in_around (page))
+			return false;
+	} else if (!vm_do_claim_page (page))
+		return false;
+	if (page->advice == MADV_SEQUENTIAL)
+		vm_drop_behind (page);
+	return true;
+}
+
+/* Counts in STATS a fault of CAUSE that took CYCLES CPU cycles and
+ * moved IO_CNT disk sectors. */
+static void
+fault_stats_add (struct fault_stats *stats, enum fault_cause cause,
+		uint64_t cycles, long long io_cnt) {
+	struct fault_class_stats *cs = &stats->causes[cause];
+	size_t bucket = 0;
+
+	while (bucket < FAULT_HIST_CNT - 1
+			&& cycles >= 1ULL << (FAULT_HIST_SHIFT + bucket))
+		bucket++;
+	cs->cnt++;
+	cs->io_cnt += io_cnt;
+	cs->cycles += cycles;
+	cs->hist[bucket]++;
 }
 
 /* Return true on success */
+/* Each fault is timed, together with the disk I/O done to handle it,
+ * and counted by cause in the faulting process's statistics and in
+ * the global ones. */
 bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
-		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
-	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
-	struct page *page = NULL;
-	/* TODO: Validate the fault */
-	/* TODO: Your code goes here */
+vm_try_handle_fault (struct intr_frame *f, void *addr,
+		bool user, bool write, bool not_present) {
+	struct thread *t = thread_current ();
+	enum fault_cause cause = FAULT_INVALID;
+	long long disk_cnt = t->disk_cnt;
+	uint64_t start = rdtsc ();
+	bool success = vm_handle_fault (f, addr, user, write, not_present,
+			&cause);
+	uint64_t cycles = rdtsc () - start;
+	enum intr_level old_level;
 
-	return vm_do_claim_page (page);
+	if (!success)
+		cause = FAULT_INVALID;
+	if (t->fault_stats == NULL)
+		t->fault_stats = calloc (1, sizeof *t->fault_stats);
+	if (t->fault_stats != NULL)
+		fault_stats_add (t->fault_stats, cause, cycles,
+				t->disk_cnt - disk_cnt);
+	old_level = intr_disable ();
+	fault_stats_add (&fault_stats, cause, cycles, t->disk_cnt - disk_cnt);
+	intr_set_level (old_level);
+	return success;
+}
+
+/* Prints STATS, the page fault statistics of WHO, one line per cause
+ * of fault, with the latency histogram in thousands of cycles.
+ * Prints nothing if STATS is a null pointer. */
+void
+vm_print_fault_stats (const char *who, const struct fault_stats *stats) {
+	int cause;
+	size_t i;
+
+	if (stats == NULL)
+		return;
+	for (cause = 0; cause < FAULT_CAUSE_CNT; cause++) {
+		const struct fault_class_stats *cs = &stats->causes[cause];
+
+		if (cs->cnt == 0)
+			continue;
+		printf ("%s: %llu %s, %llu sectors, %llu cycles avg:", who, cs->cnt,
+				fault_cause_names[cause], cs->io_cnt, cs->cycles / cs->cnt);
+		for (i = 0; i < FAULT_HIST_CNT - 1; i++)
+			if (cs->hist[i] != 0)
+				printf (" <%lluK %u", (1ULL << (FAULT_HIST_SHIFT + i)) / 1024,
+						cs->hist[i]);
+		if (cs->hist[i] != 0)
+			printf (" >=%lluK %u",
+					(1ULL << (FAULT_HIST_SHIFT + i - 1)) / 1024, cs->hist[i]);
+		printf ("\n");
+	}
+}
+
+/* Returns true if PAGE is mapped writable in its owner's page
+ * table. */
+static bool
+page_is_mapped_writable (struct page *page) {
+	uint64_t *pte = pml4e_walk (page->owner->pml4, (uint64_t) page->va, 0);
+
+	return pte != NULL && (*pte & PTE_P) != 0 && (*pte & PTE_W) != 0;
+}
+
+/* Makes PAGE resident, mapped writable if WRITE, and pins its frame.
+ * Returns false if the page could not be brought in. */
+static bool
+vm_pin_user_page (struct page *page, bool write) {
+	for (;;) {
+		bool resident;
+
+		lock_acquire (&frame_lock);
+		resident = frame_wait_eviction (page) != NULL;
+		if (resident && (!write || page_is_mapped_writable (page))) {
+			page->frame->pin_cnt++;
+			lock_release (&frame_lock);
+			return true;
+		}
+		lock_release (&frame_lock);
+
+		/* A shared or clean frame gets unshared or marked dirty
+		 * now, rather than on the kernel's first write. */
+		if (resident ? !vm_handle_wp (page) : !vm_do_claim_page (page))
+			return false;
+	}
+}
+
+/* Faults in the current process's pages in the SIZE bytes at ADDR
+ * and pins their frames, so that the kernel can copy from them, or
+ * into them if WRITE, without faulting and without the frames being
+ * evicted meanwhile.  The stack grows into the range as it would on
+ * a fault during the current system call.
+ * Pinned frames cannot be reclaimed, so large transfers should pin
+ * and copy a piece at a time.  Returns false, with nothing pinned, if
+ * the range is not valid user memory or could not be brought in. */
+bool
+vm_pin_range (const void *addr, size_t size, bool write) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *start = pg_round_down (addr);
+	uint8_t *end = (uint8_t *) addr + size;
+	uint8_t *va;
+
+	if (size == 0)
+		return true;
+	if (!is_user_vaddr (addr) || end < (uint8_t *) addr
+			|| !is_user_vaddr (end - 1))
+		return false;
+	for (va = start; va < end; va += PGSIZE) {
+		struct page *page = spt_find_page (spt, va);
+
+		if (page == NULL) {
+			struct vma *vma = vma_find (spt, va);
+
+			const void *first = va > (uint8_t *) addr ? va : addr;
+
+			if (vma != NULL && !vma->stack)
+				page = vm_alloc_vma_page (spt, vma, va);
+			else if (vma != NULL && stack_access_ok (first, NULL, false)
+					&& vm_stack_growth (va))
+				page = spt_find_page (spt, va);
+		}
+		if (page == NULL || (write && !page->writable)
+				|| !vm_pin_user_page (page, write)) {
+			vm_unpin_range (start, va - start);
+			return false;
+		}
+	}
+	return true;
+}
+
+/* Undoes vm_pin_range() of the SIZE bytes at ADDR. */
+void
+vm_unpin_range (const void *addr, size_t size) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *end = (uint8_t *) addr + size;
+	uint8_t *va;
+
+	for (va = pg_round_down (addr); va < end; va += PGSIZE)
+		vm_unpin_page (spt_find_page (spt, va));
+}
+
+/* Copies the page fault statistics chosen by WHO, FAULTSTAT_SELF or
+ * FAULTSTAT_ALL, to STATS in the current process's memory.  Returns
+ * 0 if successful, -1 if the arguments are invalid. */
+int
+vm_faultstat (int who, struct fault_stats *stats) {
+	struct thread *t = thread_current ();
+	struct fault_stats copy;
+	enum intr_level old_level;
+
+	if (who == FAULTSTAT_ALL) {
+		old_level = intr_disable ();
+		copy = fault_stats;
+		intr_set_level (old_level);
+	} else if (who == FAULTSTAT_SELF && t->fault_stats != NULL)
+		copy = *t->fault_stats;
+	else if (who == FAULTSTAT_SELF)
+		memset (&copy, 0, sizeof copy);
+	else
+		return -1;
+	return copy_to_user (stats, &copy, sizeof copy) == 0 ? 0 : -1;
+}
+
+/* Frees the memory PAGE holds, for MADV_DONTNEED.  A file page is
+ * unmapped, leaving its data to the page cache frame, which the clock
+ * is told to reclaim first.  An anonymous page is thrown away, with
+ * its frame and its swap slot, and is created afresh from its area
+ * on the next touch: a pending zero-fill page, or for an executable
+ * segment a page loaded from the file again. */
+static void
+vm_dontneed (struct page *page) {
+	switch (page_get_type (page)) {
+		case VM_FILE:
+			vm_deactivate_page (page);
+			vm_free_frame (page);
+			break;
+		case VM_ANON:
+			if (VM_TYPE (page->operations->type) == VM_ANON)
+				spt_remove_page (&page->owner->spt, page);
+			break;
+		default:
+			break;
+	}
+}
+
+/* Sets the advice of the areas of SPT in [START, END), splitting the
+ * areas that straddle either end, and of their pages.  Returns false
+ * if out of memory. */
+static bool
+vm_set_advice (struct supplemental_page_table *spt, uint8_t *start,
+		uint8_t *end, int advice) {
+	struct vma *vma;
+	struct page *page;
+
+	for (vma = vma_next (spt, start); vma != NULL && vma->start < end;
+			vma = vma_next (spt, vma->end)) {
+		if (vma->start < start) {
+			vma = vma_split (spt, vma, start);
+			if (vma == NULL)
+				return false;
+		}
+		if (vma->end > end && vma_split (spt, vma, end) == NULL)
+			return false;
+		vma->advice = advice;
+	}
+	for (page = spt_next_page (spt, start, end); page != NULL;
+			page = spt_next_page (spt, (uint8_t *) page->va + PGSIZE, end))
+		page->advice = advice;
+	return true;
+}
+
+/* Applies ADVICE, one of the MADV_* values, to the current
+ * process's pages in the LENGTH bytes at ADDR, which must be
+ * page-aligned.  MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL set
+ * how faults on the pages read ahead and, for MADV_SEQUENTIAL, that
+ * the pages a scan leaves behind go first; MADV_WILLNEED queues the
+ * file data the range maps to be read into the page cache in the
+ * background; MADV_DONTNEED frees the pages' memory right away,
+ * and anonymous pages start over as their area first made them.
+ * Returns 0 if successful, -1 if the arguments are invalid or memory
+ * ran out. */
+int
+vm_madvise (void *addr, size_t length, int advice) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	uint8_t *start = addr, *end, *va;
+	struct vma *vma;
+	struct page *page;
+	size_t page_cnt;
+
+	if (pg_ofs (addr) != 0 || !is_user_vaddr (addr)
+			|| advice < MADV_NORMAL || advice > MADV_DONTNEED)
+		return -1;
+	page_cnt = DIV_ROUND_UP (length, PGSIZE);
+	if (page_cnt > ((uint64_t) KERN_BASE - (uint64_t) addr) / PGSIZE)
+		return -1;
+	end = start + page_cnt * PGSIZE;
+
+	switch (advice) {
+		case MADV_WILLNEED:
+			for (vma = vma_next (spt, start); vma != NULL && vma->start < end;
+					vma = vma_next (spt, vma->end))
+				if (vma->map != NULL)
+					file_backed_prefetch (vma,
+							vma->start > start ? vma->start : start,
+							vma->end < end ? vma->end : end);
+			break;
+		case MADV_DONTNEED:
+			for (page = spt_next_page (spt, start, end); page != NULL;
+					page = spt_next_page (spt, va + PGSIZE, end)) {
+				va = page->va;
+				vm_dontneed (page);
+			}
+			break;
+		default:
+			if (!vm_set_advice (spt, start, end, advice))
+				return -1;
+			break;
+	}
+	return 0;
 }
 
 /* Free the page.
@@ -148,43 +1690,377 @@ vm_dealloc_page (struct page *page) {
 	free (page);
 }
 
-/* Claim the page that allocate on VA. */
+/* Claim the page that allocate on VA.
+ * The page is created from its area if it does not exist yet. */
 bool
-vm_claim_page (void *va UNUSED) {
-	struct page *page = NULL;
-	/* TODO: Fill this function */
+vm_claim_page (void *va) {
+	struct supplemental_page_table *spt = &vm_owner ()->spt;
+	struct page *page = spt_find_page (spt, va);
+
+	if (page == NULL) {
+		struct vma *vma = vma_find (spt, va);
 
+		if (vma == NULL)
+			return false;
+		page = vm_alloc_vma_page (spt, vma, va);
+		if (page == NULL)
+			return false;
+	}
 	return vm_do_claim_page (page);
 }
 
-/* Claim the PAGE and set up the mmu. */
+/* Claim the PAGE and set up the mmu.
+ * File-backed pages map the page cache frame holding their part of
+ * the file instead of getting a frame of their own. */
 static bool
 vm_do_claim_page (struct page *page) {
-	struct frame *frame = vm_get_frame ();
+	if (page_get_type (page) == VM_FILE)
+		return file_backed_claim (page, true);
+	return vm_claim_into (page, vm_get_frame ());
+}
 
+/* Loads PAGE into FRAME, which must be pinned and empty, and maps
+ * it, unless it is a kernel page such as a page cache page.  The
+ * frame stays pinned while the page is read in, so the clock cannot
+ * pick it before it holds valid contents. */
+static bool
+vm_claim_into (struct page *page, struct frame *frame) {
 	/* Set links */
+	lock_acquire (&frame_lock);
 	frame->page = page;
 	page->frame = frame;
+	list_push_back (&frame->pages, &page->frame_elem);
+	lock_release (&frame_lock);
 
-	/* TODO: Insert page table entry to map page's VA to frame's PA. */
+	/* Map page's VA to frame's PA once the contents are in place. */
+	if (!swap_in (page, frame->kva)
+			|| (page->owner != NULL
+				&& !pml4_set_page (page->owner->pml4, page->va, frame->kva,
+					page->writable))) {
+		lock_acquire (&frame_lock);
+		list_remove (&page->frame_elem);
+		page->frame = NULL;
+		frame->page = NULL;
+		lock_release (&frame_lock);
+		vm_release_frame (frame);
+		return false;
+	}
 
-	return swap_in (page, frame->kva);
+	lock_acquire (&frame_lock);
+	frame->pin_cnt--;
+	lock_release (&frame_lock);
+	return true;
 }
 
 /* Initialize new supplemental page table */
 void
-supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
+supplemental_page_table_init (struct supplemental_page_table *spt) {
+	spt->vmas = NULL;
+	spt->pages = NULL;
+}
+
+/* Makes DST_PAGE share SRC_PAGE's frame, which must be pinned.  Both
+ * are mapped read-only, so that the first write to either comes
+ * through vm_handle_wp(): a copy made by fork then gets a frame of
+ * its own, and a file mapping of a page cache frame marks it dirty. */
+bool
+vm_share_frame (struct page *dst_page, struct page *src_page) {
+	struct frame *frame = src_page->frame;
+	bool success;
+
+	lock_acquire (&frame_lock);
+	dst_page->frame = frame;
+	list_push_back (&frame->pages, &dst_page->frame_elem);
+	success = pml4_set_page (dst_page->owner->pml4, dst_page->va, frame->kva,
+			false);
+	if (success && src_page->writable)
+		pml4_set_page (src_page->owner->pml4, src_page->va, frame->kva, false);
+	if (!success) {
+		list_remove (&dst_page->frame_elem);
+		dst_page->frame = NULL;
+	}
+	lock_release (&frame_lock);
+	return success;
 }
 
-/* Copy supplemental page table from src to dst */
+/* Copy supplemental page table from src to dst.
+ * DST gets a copy of every area of SRC, from which the pages SRC has
+ * not created yet are created on demand in DST too.  Resident pages
+ * of SRC are shared copy-on-write with new pages of the current
+ * thread, which must own DST.  Pages not yet loaded are shared the
+ * same way once loaded, unless their initializer needs no auxiliary
+ * data, in which case the child simply gets its own pending page. */
 bool
-supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED,
-		struct supplemental_page_table *src UNUSED) {
+supplemental_page_table_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct page *src_page;
+
+	if (!vma_copy (dst, src))
+		return false;
+	for (src_page = spt_next_page (src, NULL, (void *) KERN_BASE);
+			src_page != NULL;
+			src_page = spt_next_page (src, (uint8_t *) src_page->va + PGSIZE,
+				(void *) KERN_BASE)) {
+		struct page *dst_page;
+
+		if (VM_TYPE (src_page->operations->type) == VM_UNINIT
+				&& src_page->uninit.aux == NULL) {
+			if (!vm_alloc_page_with_initializer (src_page->uninit.type,
+						src_page->va, src_page->writable,
+						src_page->uninit.init, NULL))
+				return false;
+			continue;
+		}
+
+		/* Aux data belongs to a single page, so load the page and
+		 * share its frame instead. */
+		if (!vm_pin_page (src_page))
+			return false;
+		dst_page = malloc (sizeof *dst_page);
+		if (dst_page == NULL) {
+			vm_unpin_page (src_page);
+			return false;
+		}
+		*dst_page = *src_page;
+		dst_page->owner = thread_current ();
+		dst_page->frame = NULL;
+		if (VM_TYPE (dst_page->operations->type) == VM_ANON)
+			dst_page->anon.ra = false;
+		if (!spt_insert_page (dst, dst_page)) {
+			free (dst_page);
+			vm_unpin_page (src_page);
+			return false;
+		}
+		if (page_get_type (dst_page) == VM_FILE)
+			mmap_file_get (dst_page->file.map);
+		if (!vm_share_frame (dst_page, src_page)) {
+			vm_unpin_page (src_page);
+			return false;
+		}
+		vm_unpin_page (src_page);
+	}
+	return true;
+}
+
+/* Frees radix tree NODE, at LEVEL, and the pages below it. */
+static void
+spt_destroy_node (struct spt_node *node, int level) {
+	size_t i;
+
+	if (node == NULL)
+		return;
+	for (i = 0; i < SPT_FANOUT; i++)
+		if (level == SPT_LEVELS - 1) {
+			if (node->slots[i] != NULL)
+				vm_dealloc_page (node->slots[i]);
+		} else
+			spt_destroy_node (node->slots[i], level + 1);
+	free (node);
 }
 
-/* Free the resource hold by the supplemental page table */
+/* Free the resource hold by the supplemental page table.
+ * Writable file mappings are written back first, while the dirty
+ * bits of their pages are still there to say what changed.  The
+ * pages go next, since they refer to their areas' mappings. */
 void
-supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	/* TODO: Destroy all the supplemental_page_table hold by thread and
-	 * TODO: writeback all the modified contents to the storage. */
+supplemental_page_table_kill (struct supplemental_page_table *spt) {
+	struct vma *vma;
+
+	for (vma = vma_next (spt, NULL); vma != NULL;
+			vma = vma_next (spt, vma->end))
+		if (vma->map != NULL && vma->writable)
+			file_backed_sync (vma, vma->start, vma->end);
+	spt_destroy_node (spt->pages, 0);
+	spt->pages = NULL;
+	vma_kill (spt);
+}
+
+/* Returns a hash value for frame E in KSM_INDEX. */
+static uint64_t
+ksm_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_entry (e, struct frame, ksm_elem)->checksum;
+}
+
+/* Returns true if frame A precedes frame B in KSM_INDEX. */
+static bool
+ksm_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct frame, ksm_elem)->checksum
+		< hash_entry (b, struct frame, ksm_elem)->checksum;
+}
+
+/* Removes FRAME from KSM_INDEX, if it is there.  Must be called with
+ * FRAME_LOCK held. */
+static void
+ksm_unindex (struct frame *frame) {
+	if (frame->ksm_indexed) {
+		hash_delete (&ksm_index, &frame->ksm_elem);
+		frame->ksm_indexed = false;
+	}
+}
+
+/* Prints same-page merging statistics: the frames shared by merged
+ * pages, and how many pages beyond the first map each of them. */
+static void
+ksm_print_stats (void) {
+	size_t shared = 0, sharing = 0;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame_table); e != list_end (&frame_table);
+			e = list_next (e)) {
+		struct frame *frame = list_entry (e, struct frame, elem);
+		size_t cnt = list_size (&frame->pages);
+
+		if (frame->ksm && cnt > 1) {
+			shared++;
+			sharing += cnt - 1;
+		}
+	}
+	printf ("KSM: %lld frames scanned, %zu pages shared, %zu pages sharing\n",
+			ksm_scan_cnt, shared, sharing);
+}
+
+/* Returns true if FRAME may be merged with another: it is mapped by
+ * resident anonymous pages only and is not pinned. */
+static bool
+ksm_candidate (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame->pin_cnt > 0 || frame->page == NULL)
+		return false;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		if (page->owner == NULL
+				|| VM_TYPE (page->operations->type) != VM_ANON)
+			return false;
+	}
+	return true;
+}
+
+/* Moves the pages of FRAME to STABLE if the two hold the same
+ * contents, mapping them read-only, and removes FRAME from the frame
+ * table for the caller to free.  Both frames are write-protected
+ * before they are compared, so that neither can change meanwhile.
+ * Must be called with FRAME_LOCK held. */
+static bool
+ksm_merge (struct frame *frame, struct frame *stable) {
+	frame->dirty = frame_is_dirty (frame);
+	frame_write_protect (frame);
+	stable->dirty = frame_is_dirty (stable);
+	frame_write_protect (stable);
+	if (memcmp (frame->kva, stable->kva, PGSIZE) != 0)
+		return false;
+
+	while (!list_empty (&frame->pages)) {
+		struct page *page = list_entry (list_pop_front (&frame->pages),
+				struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+		bool accessed = pml4_is_accessed (pml4, page->va);
+
+		page->frame = stable;
+		list_push_back (&stable->pages, &page->frame_elem);
+		pml4_set_page (pml4, page->va, stable->kva, false);
+		pml4_set_accessed (pml4, page->va, accessed);
+	}
+	stable->dirty = stable->dirty || frame->dirty;
+	stable->ksm = true;
+	frame->page = NULL;
+	frame_table_remove (frame);
+	return true;
+}
+
+/* Examines FRAME for ksmd.  A frame whose checksum changed since
+ * the last visit is still being written: it leaves the index and the
+ * new checksum is only remembered.  One that held still is merged
+ * into the indexed frame with the same checksum, or indexed itself if
+ * there is none.  Returns FRAME if it was merged, for the caller to
+ * free.  Must be called with FRAME_LOCK held. */
+static struct frame *
+ksm_scan_frame (struct frame *frame) {
+	struct hash_elem *e;
+	struct frame *stable;
+	uint64_t checksum;
+
+	ksm_scan_cnt++;
+	if (!ksm_candidate (frame))
+		return NULL;
+	checksum = hash_bytes (frame->kva, PGSIZE);
+	if (checksum != frame->checksum) {
+		ksm_unindex (frame);
+		frame->checksum = checksum;
+		return NULL;
+	}
+	if (frame->ksm_indexed)
+		return NULL;
+
+	e = hash_insert (&ksm_index, &frame->ksm_elem);
+	if (e == NULL) {
+		frame->ksm_indexed = true;
+		return NULL;
+	}
+	stable = hash_entry (e, struct frame, ksm_elem);
+	if (!ksm_candidate (stable) || !ksm_merge (frame, stable))
+		return NULL;
+	return frame;
+}
+
+/* Same-page merging daemon: every KSM_SLEEP ticks, examines the next
+ * vm_ksm_pages frames of the frame table. */
+static void
+ksmd (void *aux UNUSED) {
+	for (;;) {
+		size_t i;
+
+		timer_sleep (KSM_SLEEP);
+		for (i = 0; i < vm_ksm_pages; i++) {
+			struct frame *merged = NULL;
+
+			lock_acquire (&frame_lock);
+			if (!list_empty (&frame_table))
+				merged = ksm_scan_frame (clock_advance (&ksm_cursor));
+			lock_release (&frame_lock);
+
+			if (merged != NULL) {
+				palloc_free_page (merged->kva);
+				free (merged);
+			}
+		}
+	}
+}
+
+/* Reclaim daemon: sleeps until free frames drop below WMARK_LOW,
+ * then evicts frames until WMARK_HIGH are free.  Dirty file pages
+ * are handed to kworkerd first, which writes them back in disk order
+ * while the clock goes for the clean frames.  When nothing can be
+ * evicted, kswapd backs off for KSWAPD_BACKOFF ticks. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		enum intr_level old_level = intr_disable ();
+		size_t reclaimed = 0, i;
+
+		if (palloc_free_cnt (PAL_USER) >= wmark_low) {
+			kswapd_idle = true;
+			sema_down (&kswapd_sema);
+		}
+		intr_set_level (old_level);
+
+		page_cache_wake_kworkerd (true);
+		while (palloc_free_cnt (PAL_USER) < wmark_high) {
+			for (i = 0; i < KSWAPD_BATCH; i++) {
+				struct frame *frame = vm_evict_frame ();
+
+				if (frame == NULL)
+					break;
+				vm_release_frame (frame);
+				reclaimed++;
+			}
+			if (i < KSWAPD_BATCH)
+				break;
+		}
+		kswapd_cnt += reclaimed;
+		if (reclaimed == 0)
+			timer_sleep (KSWAPD_BACKOFF);
+	}
 }
@@ -0,0 +1,221 @@
+/* vma.c: Virtual memory areas of a process. */
+
+#include "vm/vma.h"
+#include <debug.h>
+#include <hash.h>
+#include <mman.h>
+#include "threads/malloc.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* The areas of an address space never overlap, so a search tree
+ * ordered by start address answers every interval query: the area
+ * holding an address is the one with the greatest start at or below
+ * it.  The tree is a treap whose priorities hash the start address,
+ * which keeps it balanced in expectation without any rebalancing
+ * bookkeeping. */
+
+/* Splits tree T into *L, the areas that start below KEY, and *R,
+ * the rest. */
+static void
+treap_split (struct vma *t, const uint8_t *key, struct vma **l,
+		struct vma **r) {
+	if (t == NULL)
+		*l = *r = NULL;
+	else if (t->start < key) {
+		treap_split (t->right, key, &t->right, r);
+		*l = t;
+	} else {
+		treap_split (t->left, key, l, &t->left);
+		*r = t;
+	}
+}
+
+/* Joins trees L and R, every area of L lying below every area of
+ * R, and returns the result. */
+static struct vma *
+treap_merge (struct vma *l, struct vma *r) {
+	if (l == NULL)
+		return r;
+	if (r == NULL)
+		return l;
+	if (l->prio > r->prio) {
+		l->right = treap_merge (l->right, r);
+		return l;
+	}
+	r->left = treap_merge (l, r->left);
+	return r;
+}
+
+/* Adds VMA to SPT's tree. */
+static void
+treap_insert (struct supplemental_page_table *spt, struct vma *vma) {
+	struct vma *l, *r;
+
+	vma->prio = hash_bytes (&vma->start, sizeof vma->start);
+	vma->left = vma->right = NULL;
+	treap_split (spt->vmas, vma->start, &l, &r);
+	spt->vmas = treap_merge (treap_merge (l, vma), r);
+}
+
+/* Removes VMA from SPT's tree. */
+static void
+treap_delete (struct supplemental_page_table *spt, struct vma *vma) {
+	struct vma *l, *m, *r;
+
+	treap_split (spt->vmas, vma->start, &l, &m);
+	treap_split (m, vma->start + 1, &m, &r);
+	ASSERT (m == vma);
+	spt->vmas = treap_merge (l, r);
+}
+
+/* Creates an area of SPT for the pages in [START, END), which must
+ * be page-aligned, with no pages yet.  The caller fills in where the
+ * pages come from.  Returns a null pointer if the range overlaps
+ * another area or if out of memory. */
+struct vma *
+vma_create (struct supplemental_page_table *spt, void *start, void *end,
+		bool writable) {
+	struct vma *vma;
+
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT (start < end);
+
+	if (vma_overlaps (spt, start, end))
+		return NULL;
+	vma = malloc (sizeof *vma);
+	if (vma == NULL)
+		return NULL;
+	vma->start = start;
+	vma->end = end;
+	vma->writable = writable;
+	vma->stack = false;
+	vma->advice = MADV_NORMAL;
+	vma->alloc_page = NULL;
+	vma->map = NULL;
+	vma->ofs = 0;
+	vma->read_bytes = 0;
+	treap_insert (spt, vma);
+	return vma;
+}
+
+/* Returns the area of SPT that holds VA, or a null pointer. */
+struct vma *
+vma_find (struct supplemental_page_table *spt, const void *va) {
+	struct vma *t = spt->vmas, *best = NULL;
+
+	while (t != NULL)
+		if (t->start <= (const uint8_t *) va) {
+			best = t;
+			t = t->right;
+		} else
+			t = t->left;
+	return best != NULL && (const uint8_t *) va < best->end ? best : NULL;
+}
+
+/* Returns the lowest area of SPT that ends above VA, or a null
+ * pointer.  Walks the areas in a range together with the range's
+ * end. */
+struct vma *
+vma_next (struct supplemental_page_table *spt, const void *va) {
+	struct vma *t = spt->vmas, *best = NULL;
+
+	while (t != NULL)
+		if (t->end > (const uint8_t *) va) {
+			best = t;
+			t = t->left;
+		} else
+			t = t->right;
+	return best;
+}
+
+/* Returns true if any area of SPT overlaps [START, END). */
+bool
+vma_overlaps (struct supplemental_page_table *spt, const void *start,
+		const void *end) {
+	struct vma *vma = vma_next (spt, start);
+
+	return vma != NULL && vma->start < (const uint8_t *) end;
+}
+
+/* Splits VMA at VA, which must be a page boundary inside it, and
+ * returns the new area for the part from VA up.  Returns a null
+ * pointer, leaving VMA whole, if out of memory. */
+struct vma *
+vma_split (struct supplemental_page_table *spt, struct vma *vma, void *va) {
+	struct vma *upper;
+	size_t delta;
+
+	ASSERT (pg_ofs (va) == 0);
+	ASSERT (vma->start < (uint8_t *) va && (uint8_t *) va < vma->end);
+
+	upper = malloc (sizeof *upper);
+	if (upper == NULL)
+		return NULL;
+	*upper = *vma;
+	delta = (uint8_t *) va - vma->start;
+	upper->start = va;
+	upper->ofs = vma->ofs + delta;
+	upper->read_bytes = vma->read_bytes > delta ? vma->read_bytes - delta : 0;
+	vma->end = va;
+	vma->read_bytes = vma->read_bytes < delta ? vma->read_bytes : delta;
+	if (upper->map != NULL)
+		mmap_file_get (upper->map);
+	treap_insert (spt, upper);
+	return upper;
+}
+
+/* Removes VMA from SPT and frees it.  Its pages must be gone
+ * already. */
+void
+vma_remove (struct supplemental_page_table *spt, struct vma *vma) {
+	treap_delete (spt, vma);
+	if (vma->map != NULL)
+		mmap_file_put (vma->map);
+	free (vma);
+}
+
+/* Adds copies of the areas in tree T to DST. */
+static bool
+copy_tree (struct supplemental_page_table *dst, const struct vma *t) {
+	struct vma *copy;
+
+	if (t == NULL)
+		return true;
+	if (!copy_tree (dst, t->left))
+		return false;
+	copy = malloc (sizeof *copy);
+	if (copy == NULL)
+		return false;
+	*copy = *t;
+	if (copy->map != NULL)
+		mmap_file_get (copy->map);
+	treap_insert (dst, copy);
+	return copy_tree (dst, t->right);
+}
+
+/* Gives DST, which has no areas, a copy of every area of SRC. */
+bool
+vma_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	return copy_tree (dst, src->vmas);
+}
+
+/* Frees tree T. */
+static void
+free_tree (struct vma *t) {
+	if (t == NULL)
+		return;
+	free_tree (t->left);
+	free_tree (t->right);
+	if (t->map != NULL)
+		mmap_file_put (t->map);
+	free (t);
+}
+
+/* Frees every area of SPT, whose pages must be gone already. */
+void
+vma_kill (struct supplemental_page_table *spt) {
+	free_tree (spt->vmas);
+	spt->vmas = NULL;
+}
@@ -0,0 +1,353 @@
+/* zswap.c: Compressed cache in front of the swap disk. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Anonymous pages being swapped out are compressed into pool pages
+ * taken from the kernel pool, zbud style: each pool page holds at
+ * most two compressed pages, one packed against its start and one
+ * against its end.  A page that does not compress to ZSWAP_MAX_LEN
+ * bytes or less, or that finds the pool full, goes to the swap disk
+ * instead. */
+size_t zswap_pool_max = ZSWAP_POOL_DEFAULT;
+
+/* Largest compressed page worth keeping. */
+#define ZSWAP_MAX_LEN (PGSIZE * 3 / 4)
+
+/* A pool page. */
+struct zbud_page {
+	void *kva;                   /* The page. */
+	size_t first_len;            /* Bytes used at the start, or 0. */
+	size_t last_len;             /* Bytes used at the end, or 0. */
+	struct list_elem elem;       /* Element in UNBUDDIED. */
+};
+
+/* A compressed page, shared by every page that referred to the same
+ * frame when it was swapped out. */
+struct zswap_entry {
+	struct zbud_page *zpage;     /* Pool page holding it. */
+	bool last;                   /* At the end of ZPAGE, else the start. */
+	size_t len;                  /* Compressed size in bytes. */
+	int ref_cnt;                 /* # of references. */
+};
+
+static struct list unbuddied;       /* Pool pages with one free end. */
+static size_t pool_cnt;             /* # of pool pages. */
+static struct lock zswap_lock;      /* Protects all of the above. */
+
+/* Compression output, protected by ZSWAP_LOCK. */
+static uint8_t zswap_buffer[ZSWAP_MAX_LEN];
+
+/* Statistics. */
+static long long store_cnt;         /* # of pages stored. */
+static long long reject_cnt;        /* # of pages that compressed poorly. */
+static long long full_cnt;          /* # of pages that found the pool full. */
+static long long load_cnt;          /* # of pages loaded. */
+static long long stored_bytes;      /* Compressed size of stored pages. */
+
+/* The compressor is a byte-oriented LZ77 in the style of LZ4.  A
+ * compressed page is a series of sequences, each a token byte whose
+ * high nibble is a literal count and low nibble a match length less
+ * LZ_MIN_MATCH, the literals, a 2-byte little-endian match offset
+ * and, for a nibble of 15, the rest of each count in bytes of up to
+ * 255.  The last sequence has literals only. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+static uint16_t lz_table[1 << LZ_HASH_BITS];  /* Protected by ZSWAP_LOCK. */
+
+/* Returns the 4 bytes at P. */
+static uint32_t
+lz_read32 (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Returns the LZ_TABLE index for the 4 bytes V. */
+static size_t
+lz_hash (uint32_t v) {
+	return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Appends the extension bytes of a count LEN whose nibble was 15 to
+ * DST, which has room for CAP bytes, at *OP.  Returns false if they
+ * do not fit. */
+static bool
+lz_put_len (uint8_t *dst, size_t cap, size_t *op, size_t len) {
+	if (len < 15)
+		return true;
+	for (len -= 15; ; len -= 255) {
+		if (*op >= cap)
+			return false;
+		dst[(*op)++] = len < 255 ? len : 255;
+		if (len < 255)
+			return true;
+	}
+}
+
+/* Appends to DST, which has room for CAP bytes, at *OP, a sequence
+ * of the LIT_LEN literals at LIT followed, unless MATCH_LEN is 0, by
+ * a match of MATCH_LEN bytes OFFSET bytes back.  Returns false if it
+ * does not fit. */
+static bool
+lz_emit (uint8_t *dst, size_t cap, size_t *op, const uint8_t *lit,
+		size_t lit_len, size_t offset, size_t match_len) {
+	size_t ml = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+	if (*op >= cap)
+		return false;
+	dst[(*op)++] = (lit_len < 15 ? lit_len : 15) << 4 | (ml < 15 ? ml : 15);
+	if (!lz_put_len (dst, cap, op, lit_len) || lit_len > cap - *op)
+		return false;
+	memcpy (dst + *op, lit, lit_len);
+	*op += lit_len;
+	if (match_len > 0) {
+		if (cap - *op < 2)
+			return false;
+		dst[(*op)++] = offset & 0xff;
+		dst[(*op)++] = offset >> 8;
+		if (!lz_put_len (dst, cap, op, ml))
+			return false;
+	}
+	return true;
+}
+
+/* Compresses the SIZE bytes at SRC, at most 64 kB, into DST, which
+ * has room for CAP bytes.  Returns the compressed size, or 0 if it
+ * would exceed CAP. */
+static size_t
+lz_compress (const uint8_t *src, size_t size, uint8_t *dst, size_t cap) {
+	size_t ip = 0, anchor = 0, op = 0;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (ip + LZ_MIN_MATCH <= size) {
+		uint32_t seq = lz_read32 (src + ip);
+		size_t h = lz_hash (seq);
+		size_t ref = lz_table[h];
+		size_t len = LZ_MIN_MATCH;
+
+		lz_table[h] = ip;
+		if (ref >= ip || lz_read32 (src + ref) != seq) {
+			ip++;
+			continue;
+		}
+		while (ip + len < size && src[ref + len] == src[ip + len])
+			len++;
+		if (!lz_emit (dst, cap, &op, src + anchor, ip - anchor, ip - ref, len))
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+	if (!lz_emit (dst, cap, &op, src + anchor, size - anchor, 0, 0))
+		return 0;
+	return op;
+}
+
+/* Returns the count whose nibble was LEN, reading any extension
+ * bytes from SRC at *IP. */
+static size_t
+lz_get_len (const uint8_t *src, size_t *ip, size_t len) {
+	uint8_t b;
+
+	if (len == 15)
+		do {
+			b = src[(*ip)++];
+			len += b;
+		} while (b == 255);
+	return len;
+}
+
+/* Decompresses the SIZE bytes at SRC, produced by lz_compress(),
+ * into DST, and returns the decompressed size. */
+static size_t
+lz_decompress (const uint8_t *src, size_t size, uint8_t *dst) {
+	size_t ip = 0, op = 0;
+
+	for (;;) {
+		uint8_t token = src[ip++];
+		size_t lit = lz_get_len (src, &ip, token >> 4);
+		size_t offset, ml;
+
+		memcpy (dst + op, src + ip, lit);
+		ip += lit;
+		op += lit;
+		if (ip >= size)
+			return op;
+		offset = src[ip] | (size_t) src[ip + 1] << 8;
+		ip += 2;
+		for (ml = lz_get_len (src, &ip, token & 15) + LZ_MIN_MATCH; ml > 0;
+				ml--, op++)
+			dst[op] = dst[op - offset];
+	}
+}
+
+/* Initializes zswap. */
+void
+zswap_init (void) {
+	list_init (&unbuddied);
+	lock_init (&zswap_lock);
+}
+
+/* Prints zswap statistics. */
+void
+zswap_print_stats (void) {
+	long long ratio = stored_bytes > 0
+		? store_cnt * PGSIZE * 100 / stored_bytes : 0;
+
+	printf ("zswap: %lld pages stored, %lld rejected, %lld over pool limit, "
+			"%lld loaded, compression ratio %lld.%02lld, %zu pool pages\n",
+			store_cnt, reject_cnt, full_cnt, load_cnt, ratio / 100, ratio % 100,
+			pool_cnt);
+}
+
+/* Finds room for LEN compressed bytes in the pool, in a page with a
+ * free end or else a new page, and stores its location in ENTRY.
+ * Returns false if the pool is full.  Must be called with ZSWAP_LOCK
+ * held. */
+static bool
+zbud_alloc (struct zswap_entry *entry, size_t len) {
+	struct zbud_page *zpage;
+	struct list_elem *e;
+
+	for (e = list_begin (&unbuddied); e != list_end (&unbuddied);
+			e = list_next (e)) {
+		zpage = list_entry (e, struct zbud_page, elem);
+		if (zpage->first_len + zpage->last_len + len <= PGSIZE) {
+			list_remove (&zpage->elem);
+			entry->last = zpage->first_len > 0;
+			goto found;
+		}
+	}
+
+	if (pool_cnt >= zswap_pool_max)
+		return false;
+	zpage = malloc (sizeof *zpage);
+	if (zpage == NULL)
+		return false;
+	zpage->kva = palloc_get_page (0);
+	if (zpage->kva == NULL) {
+		free (zpage);
+		return false;
+	}
+	zpage->first_len = zpage->last_len = 0;
+	pool_cnt++;
+	list_push_back (&unbuddied, &zpage->elem);
+	entry->last = false;
+
+found:
+	if (entry->last)
+		zpage->last_len = len;
+	else
+		zpage->first_len = len;
+	entry->zpage = zpage;
+	entry->len = len;
+	return true;
+}
+
+/* Releases ENTRY's room in its pool page, freeing the page when it
+ * becomes empty.  Must be called with ZSWAP_LOCK held. */
+static void
+zbud_free (struct zswap_entry *entry) {
+	struct zbud_page *zpage = entry->zpage;
+	bool was_full = zpage->first_len > 0 && zpage->last_len > 0;
+
+	if (entry->last)
+		zpage->last_len = 0;
+	else
+		zpage->first_len = 0;
+	if (zpage->first_len == 0 && zpage->last_len == 0) {
+		if (!was_full)
+			list_remove (&zpage->elem);
+		palloc_free_page (zpage->kva);
+		free (zpage);
+		pool_cnt--;
+	} else if (was_full)
+		list_push_back (&unbuddied, &zpage->elem);
+}
+
+/* Returns the address of ENTRY's compressed data. */
+static uint8_t *
+entry_data (struct zswap_entry *entry) {
+	uint8_t *kva = entry->zpage->kva;
+	return entry->last ? kva + PGSIZE - entry->len : kva;
+}
+
+/* Compresses the page at KVA into the pool and returns an entry for
+ * it, with one reference, or a null pointer if the page compresses
+ * poorly or does not fit in the pool. */
+struct zswap_entry *
+zswap_store (const void *kva) {
+	struct zswap_entry *entry;
+	size_t len;
+
+	if (zswap_pool_max == 0)
+		return NULL;
+	entry = malloc (sizeof *entry);
+	if (entry == NULL)
+		return NULL;
+
+	lock_acquire (&zswap_lock);
+	len = lz_compress (kva, PGSIZE, zswap_buffer, sizeof zswap_buffer);
+	if (len == 0) {
+		reject_cnt++;
+		goto fail;
+	}
+	if (!zbud_alloc (entry, len)) {
+		full_cnt++;
+		goto fail;
+	}
+	memcpy (entry_data (entry), zswap_buffer, len);
+	entry->ref_cnt = 1;
+	store_cnt++;
+	stored_bytes += len;
+	lock_release (&zswap_lock);
+	return entry;
+
+fail:
+	lock_release (&zswap_lock);
+	free (entry);
+	return NULL;
+}
+
+/* Decompresses ENTRY into the page at KVA. */
+void
+zswap_load (struct zswap_entry *entry, void *kva) {
+	size_t size;
+
+	lock_acquire (&zswap_lock);
+	size = lz_decompress (entry_data (entry), entry->len, kva);
+	ASSERT (size == PGSIZE);
+	load_cnt++;
+	lock_release (&zswap_lock);
+}
+
+/* Adds a reference to ENTRY. */
+void
+zswap_get (struct zswap_entry *entry) {
+	lock_acquire (&zswap_lock);
+	entry->ref_cnt++;
+	lock_release (&zswap_lock);
+}
+
+/* Drops a reference to ENTRY, freeing it with the last one. */
+void
+zswap_put (struct zswap_entry *entry) {
+	bool last;
+
+	lock_acquire (&zswap_lock);
+	last = --entry->ref_cnt == 0;
+	if (last)
+		zbud_free (entry);
+	lock_release (&zswap_lock);
+	if (last)
+		free (entry);
+}